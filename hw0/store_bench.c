@@ -0,0 +1,120 @@
+/*
+ * A benchmark of LOCATE in the task_store() function.  For stores of
+ * several sizes it times LOCATE of stored keys against the linear
+ * strcmp() search the store used before keys were indexed.  Stores of
+ * up to COMPACT_MAX (128) tasks are searched in the compact SIMD layout
+ * and larger ones in the hashed layout.
+ *
+ * gcc -O2 -mavx2 -c task_store.c
+ * gcc -O2 store_bench.c task_store.o -pthread -o store_bench
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "task.h"
+
+#define LOOKUPS 2000000  // LOCATE calls timed for each store size
+#define COMPACT_MAX 128  // largest store in the compact layout (as in task_store.c)
+
+// the store before keys were indexed kept its entries in an array
+// that LOCATE searched with strcmp(); the first fields of a stored
+// entry are the same
+typedef struct {
+  const char *key;
+  task *task_ptr;
+} scan_entry;
+
+task my_task;
+FS my_fs;
+VM my_vm;
+
+scan_entry *scan_data;
+long scan_tasks;
+
+void *scan_locate(char *parm)
+{
+  char *copy = strdup(parm);
+  char *key = strtok(copy, " ");
+  char *field = strtok(NULL, " ");
+  scan_entry *found = NULL;
+  void *rc = NULL;
+
+  for (long i = 0; key && i < scan_tasks; i++) {
+    if (!strcmp(scan_data[i].key, key)) {
+      found = scan_data + i;
+      break;
+    }
+  }
+  if (found && field && !strcmp(field, "pid"))
+    rc = &(found->task_ptr->pid);
+  free(copy);
+  return rc;
+}
+
+double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// times LOCATE of random stored keys, returning nanoseconds per call
+double bench(void *(*locate)(char *parm), char **parms, long n)
+{
+  long sum = 0;
+  long lookups = n > 10000 && locate == scan_locate ? LOOKUPS / 100 : LOOKUPS;
+  unsigned seed = 1;
+  double start = now();
+
+  for (long i = 0; i < lookups; i++) {
+    seed = seed * 1103515245 + 12345;
+    long *rc = (long *)locate(parms[(seed >> 8) % n]);
+    sum += rc ? *rc : 0;
+  }
+  if (sum == 0)
+    printf("no keys found\n");
+  return (now() - start) * 1e9 / lookups;
+}
+
+void *store_locate(char *parm)
+{
+  return task_store(LOCATE, parm, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+  long sizes[] = {8, 32, 100, 128, 1000, 100000};
+
+  my_task.fs_ptr = &my_fs;
+  my_task.vm_ptr = &my_vm;
+
+  printf("%8s %10s %14s %14s\n", "tasks", "layout", "indexed ns", "strcmp ns");
+  for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    long n = sizes[s];
+    char **keys = (char **)malloc(n * sizeof(char *));
+    char **parms = (char **)malloc(n * sizeof(char *));
+
+    scan_data = (scan_entry *)malloc(n * sizeof(scan_entry));
+    scan_tasks = n;
+    if (task_store(INIT, NULL, NULL) == NULL) {
+      printf("INIT failed\n");
+      return 1;
+    }
+    for (long i = 0; i < n; i++) {
+      keys[i] = (char *)malloc(24);
+      parms[i] = (char *)malloc(32);
+      sprintf(keys[i], "%ld", 4000 + 7 * i);
+      sprintf(parms[i], "%s pid", keys[i]);
+      my_task.pid = i + 1;
+      scan_data[i] = *(scan_entry *)task_store(STORE, keys[i], &my_task);
+    }
+
+    double indexed = bench(store_locate, parms, n);
+    double scanned = bench(scan_locate, parms, n);
+    printf("%8ld %10s %14.1f %14.1f\n", n, n <= COMPACT_MAX ? "compact" : "hashed", indexed, scanned);
+  }
+  return 0;
+}
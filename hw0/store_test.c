@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdatomic.h>
 
 #include "task.h"
 
@@ -31,9 +32,14 @@ typedef struct task_entry {
 // a specific set of tests
   void test1(void);
   void testdata(void);
+  void testscan(void);
+  void testfilter(void);
 
+// LOCATEs the store answered from its Bloom filter without a lookup
+extern long bloom_rejects;
 
-void main (int argc, char *argv[])
+
+int main (int argc, char *argv[])
 {
   void *rc;
 
@@ -51,7 +57,7 @@ void main (int argc, char *argv[])
   rc = task_store(INIT, NULL, NULL);
   if (rc == NULL) {
     printf("Test: INIT failed\n");
-    return;
+    return 1;
   }
   else
     printf("Test: INIT successful\n");
@@ -62,7 +68,11 @@ void main (int argc, char *argv[])
   // more test functions called here
   testdata();
 
-  return;
+  // scans start from an empty store
+  testscan();
+  testfilter();
+
+  return 0;
 }
 
 void testdata(void)
@@ -134,7 +144,6 @@ void testdata(void)
 
   my_task.fs_ptr = NULL;
   rc = task_store(STORE, "102", &my_task);
-  task_entry *entry3 = (task_entry*) rc;
   rc = task_store(LOCATE, "102 inode_end", NULL);
   if (rc == NULL) 
     printf("Test 3: LOCATE inode_end success\n");
@@ -243,3 +252,219 @@ void test1(void)
   return;
 }
 
+
+/*
+ * Totals computed by the parallel scan functions over a large store
+ * must match the totals known from the values that were stored.
+ */
+#define SCAN_TASKS 100000
+#define VM_BUCKETS 8
+
+typedef struct {
+  long count;
+  long pid_sum;
+  long inode_min;
+  long inode_max;
+  long vm_hist[VM_BUCKETS];  // tasks by paged size in KB
+} scan_totals;
+
+atomic_long visited;
+
+void count_task(const char *key, task *t, void *arg)
+{
+  atomic_fetch_add(&visited, 1);
+}
+
+void fold_task(void *partial, const char *key, task *t)
+{
+  scan_totals *p = (scan_totals *)partial;
+  long kb = ((char *)t->vm_ptr->paged_ptr->paged_end - (char *)t->vm_ptr->paged_ptr->paged_start) / 1024;
+  p->count++;
+  p->pid_sum += t->pid;
+  if (t->fs_ptr->inode_start < p->inode_min) p->inode_min = t->fs_ptr->inode_start;
+  if (t->fs_ptr->inode_end > p->inode_max) p->inode_max = t->fs_ptr->inode_end;
+  p->vm_hist[kb < VM_BUCKETS ? kb : VM_BUCKETS - 1]++;
+}
+
+void combine_totals(void *total, const void *partial)
+{
+  scan_totals *t = (scan_totals *)total;
+  const scan_totals *p = (const scan_totals *)partial;
+  t->count += p->count;
+  t->pid_sum += p->pid_sum;
+  if (p->inode_min < t->inode_min) t->inode_min = p->inode_min;
+  if (p->inode_max > t->inode_max) t->inode_max = p->inode_max;
+  for (int i = 0; i < VM_BUCKETS; i++)
+    t->vm_hist[i] += p->vm_hist[i];
+}
+
+void testscan(void)
+{
+  void *rc;
+  char **keys = (char **)malloc(SCAN_TASKS * sizeof(char *));
+  int i;
+  scan_totals totals = {0, 0, __LONG_MAX__, -__LONG_MAX__ - 1};
+
+  my_task.vm_ptr = &my_vm;
+  my_task.fs_ptr = &my_fs;
+  my_vm.paged_ptr = &my_paged;
+  my_vm.pinned_ptr = &my_pinned;
+
+  rc = task_store(INIT, NULL, NULL);
+  for (i = 0; i < SCAN_TASKS; i++) {
+    keys[i] = (char *)malloc(16);  // the store keeps the key pointer
+    sprintf(keys[i], "%d", 1000 + i);
+    my_task.pid = (long)i;
+    my_fs.inode_start = (long)(5000 + i);
+    my_fs.inode_end = (long)(5000 + 2 * i);
+    my_paged.paged_start = (void *)0;
+    my_paged.paged_end = (void *)(long)(1024 * (i % VM_BUCKETS));
+    rc = task_store(STORE, keys[i], &my_task);
+    if (rc == NULL) {
+      printf("Test 7: STORE %d failed\n", i);
+      return;
+    }
+  }
+
+  if (task_store_for_each(count_task, NULL) || visited != SCAN_TASKS)
+    printf("Test 7: for_each failed, visited %ld\n", (long)visited);
+  else
+    printf("Test 7: for_each success\n");
+
+  rc = task_store_reduce(&totals, sizeof(totals), fold_task, combine_totals) ? NULL : &totals;
+  if (rc == NULL || totals.count != SCAN_TASKS)
+    printf("Test 8: reduce failed\n");
+  else if (totals.pid_sum != (long)SCAN_TASKS * (SCAN_TASKS - 1) / 2)
+    printf("Test 8: reduce pid sum %ld got %ld\n", (long)SCAN_TASKS * (SCAN_TASKS - 1) / 2, totals.pid_sum);
+  else if (totals.inode_min != 5000 || totals.inode_max != 5000 + 2 * (SCAN_TASKS - 1))
+    printf("Test 8: reduce inode range got %ld-%ld\n", totals.inode_min, totals.inode_max);
+  else if (totals.vm_hist[0] != SCAN_TASKS / VM_BUCKETS || totals.vm_hist[VM_BUCKETS - 1] != SCAN_TASKS / VM_BUCKETS)
+    printf("Test 8: reduce histogram failed\n");
+  else
+    printf("Test 8: reduce success\n");
+
+  // every stored key must be found, and keys never stored must miss;
+  // nearly all misses should be stopped by the filter at its default rate
+  char parm[32];
+  long misses = 0, rejects = bloom_rejects;
+  for (i = 0; i < SCAN_TASKS; i += 97) {
+    sprintf(parm, "%d pid", 1000 + i);
+    rc = task_store(LOCATE, parm, NULL);
+    if (rc == NULL || *(long *)rc != i) {
+      printf("Test 9: LOCATE %s failed\n", parm);
+      return;
+    }
+    sprintf(parm, "%d pid", 1000 + SCAN_TASKS + i);
+    rc = task_store(LOCATE, parm, NULL);
+    if (rc != NULL) {
+      printf("Test 9: LOCATE %s failed\n", parm);
+      return;
+    }
+    misses++;
+  }
+  rejects = bloom_rejects - rejects;
+  if (rejects < misses * 9 / 10)
+    printf("Test 9: filter rejected %ld of %ld misses\n", rejects, misses);
+  else
+    printf("Test 9: LOCATE hits and misses success\n");
+
+  // move the store through a file and back, whole and in part
+  FILE *whole = tmpfile();
+  FILE *part = tmpfile();
+  sprintf(parm, "%d", fileno(whole));
+  rc = task_store(EXPORT, parm, NULL);
+  if (rc == NULL || *(long *)rc != SCAN_TASKS) {
+    printf("Test 10: EXPORT failed\n");
+    return;
+  }
+  sprintf(parm, "%d %d %d", fileno(part), 1000 + 10, 1000 + 19);
+  rc = task_store(EXPORT, parm, NULL);
+  if (rc == NULL || *(long *)rc != 10) {
+    printf("Test 10: EXPORT range failed\n");
+    return;
+  }
+  rewind(whole);
+  rewind(part);
+
+  task_store(INIT, NULL, NULL);
+  for (i = 0; i < SCAN_TASKS; i++)  // INIT dropped the stored keys
+    free(keys[i]);
+  free(keys);
+  sprintf(parm, "%d", fileno(whole));
+  rc = task_store(IMPORT, parm, NULL);
+  if (rc == NULL || *(long *)rc != SCAN_TASKS) {
+    printf("Test 10: IMPORT failed\n");
+    return;
+  }
+  totals = (scan_totals){0, 0, __LONG_MAX__, -__LONG_MAX__ - 1};
+  task_store_reduce(&totals, sizeof(totals), fold_task, combine_totals);
+  if (totals.count != SCAN_TASKS || totals.pid_sum != (long)SCAN_TASKS * (SCAN_TASKS - 1) / 2 ||
+      totals.vm_hist[VM_BUCKETS - 1] != SCAN_TASKS / VM_BUCKETS)
+    printf("Test 10: IMPORT contents failed\n");
+  else if ((rc = task_store(LOCATE, "1777 inode_end", NULL)) == NULL || *(long *)rc != 5000 + 2 * 777)
+    printf("Test 10: IMPORT LOCATE failed\n");
+  else
+    printf("Test 10: EXPORT and IMPORT success\n");
+
+  task_store(INIT, NULL, NULL);
+  sprintf(parm, "%d", fileno(part));
+  rc = task_store(IMPORT, parm, NULL);
+  if (rc == NULL || *(long *)rc != 10)
+    printf("Test 11: IMPORT range failed\n");
+  else if (task_store(LOCATE, "1015 pid", NULL) == NULL || task_store(LOCATE, "1020 pid", NULL) != NULL)
+    printf("Test 11: IMPORT range contents failed\n");
+  else
+    printf("Test 11: EXPORT and IMPORT range success\n");
+  fclose(whole);
+  fclose(part);
+}
+
+/*
+ * Test the false positive rate given to INIT: a filter built for a
+ * loose rate must let clearly more misses through to the index than
+ * one built for a tight rate, and both must still answer correctly
+ */
+#define FILTER_TASKS 20000
+
+char filter_keys[FILTER_TASKS][16];
+
+long filter_rejects(char *fpr)
+{
+  char parm[32];
+  long rejects;
+  int i;
+
+  task_store(INIT, fpr, NULL);
+  for (i = 0; i < FILTER_TASKS; i++) {
+    sprintf(filter_keys[i], "%d", 2 * i);  // only even keys are stored
+    my_task.pid = (long)i;
+    if (task_store(STORE, filter_keys[i], &my_task) == NULL)
+      return -1;
+  }
+  rejects = bloom_rejects;
+  for (i = 0; i < FILTER_TASKS; i++) {
+    sprintf(parm, "%d pid", 2 * i + 1);
+    if (task_store(LOCATE, parm, NULL) != NULL)
+      return -1;
+  }
+  return bloom_rejects - rejects;
+}
+
+void testfilter(void)
+{
+  long tight, loose;
+
+  my_task.vm_ptr = &my_vm;
+  my_task.fs_ptr = &my_fs;
+  my_vm.paged_ptr = &my_paged;
+  my_vm.pinned_ptr = &my_pinned;
+
+  tight = filter_rejects("0.001");
+  loose = filter_rejects("0.5");
+  if (tight < 0 || loose < 0)
+    printf("Test 12: LOCATE misses failed\n");
+  else if (tight < FILTER_TASKS * 99 / 100 || loose > FILTER_TASKS * 9 / 10 || loose >= tight)
+    printf("Test 12: filter rejected %ld (0.001) and %ld (0.5) of %d misses\n", tight, loose, FILTER_TASKS);
+  else
+    printf("Test 12: filter false positive rate success\n");
+}
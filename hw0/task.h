@@ -1,3 +1,5 @@
+#include <stddef.h>
+
 // paged has addresses (pointers) to the
 // beginning and end of paged virtual memory
 typedef struct {
@@ -39,12 +41,40 @@ typedef struct {
 // INIT - initialize any local data used internal to the function
 // STORE - make a local copy of the task representation
 // LOCATE - return a pointer to a field in the local copy
-enum operation {INIT, STORE, LOCATE};
+// EXPORT - write the local copies to a file descriptor as a binary stream
+// IMPORT - make local copies of the tasks in a stream written by EXPORT
+// EXPORT and IMPORT return a pointer to the (long) number of tasks moved
+enum operation {INIT, STORE, LOCATE, EXPORT, IMPORT};
 
 // parm is a character string with operation-specific meanings
-// INIT - not used
-// STORE - a numeric task identifier for a stored task
+// INIT - optional false positive rate of the filter LOCATE uses to reject
+//        keys that were never stored, e.g. "0.001" (NULL for 0.01)
+// STORE - a numeric task identifier for a stored task (other keys are rejected)
 // LOCATE - a numeric task identifier and a field name
+// EXPORT - a file descriptor, optionally followed by the first and last
+//          task identifiers to export, e.g. "3" or "3 100 199"
+// IMPORT - a file descriptor
 // ptr is used only for STORE and gives the address of a task
 void *task_store(enum operation op, char *parm, task *ptr);
 
+
+// task_visit is called by task_store_for_each once for every stored task,
+// with the identifier given to STORE, the stored copy and the caller's arg.
+// Calls are made concurrently from several threads.
+typedef void (*task_visit)(const char *key, task *t, void *arg);
+
+// task_accumulate folds one stored task into a partial result and
+// task_combine merges a finished partial result into the total
+typedef void (*task_accumulate)(void *partial, const char *key, task *t);
+typedef void (*task_combine)(void *total, const void *partial);
+
+// the scan functions walk all stored tasks in parallel and return 0,
+// or -1 if INIT was not called or the scan could not be set up;
+// no STORE may run while a scan is in progress, and the callbacks must
+// not start another scan; scans from different threads run one at a time
+// for_each - call fn for every stored task
+// reduce - acc points to acc_size bytes holding the identity value; each
+//   thread folds its share of the tasks into its own copy of that value
+//   and the copies are then combined into acc
+int task_store_for_each(task_visit fn, void *arg);
+int task_store_reduce(void *acc, size_t acc_size, task_accumulate fold, task_combine combine);
@@ -11,91 +11,411 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <errno.h>
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-#define MAXSIZE 50   // maximum number of tasks allowed
-int num_tasks = 0;   // num of tasks used
+#define SEGSIZE 4096        // entries per storage segment
+#define GRAIN 1024          // entries handed to a scan worker at a time
+#define MAXTHREADS 64       // upper bound on scan workers
+#define SERIAL_SCAN 4       // stores with at most this many grains are scanned inline
+#define CACHELINE 64
+#define BLOOM_FPR 0.01      // default false positive rate of the LOCATE filter
+#define BLOOM_WORDS 8       // 64-bit words in a filter block (one cache line)
+#define BLOOM_MAXK 16       // most bits set per key
+#ifndef COMPACT_MAX
+#define COMPACT_MAX 128     // stores up to this size keep keys in the compact array
+#endif
+#define MAXFIELD 16         // characters in a LOCATE field name
+#define ARENA_CHUNK (1 << 20)   // bytes the stored copies are carved from at a time
+#define WIRE_MAGIC 0x534b5354   // "TSKS" at the start of an exported stream
+#define WIRE_VERSION 1
+#define WIRE_BLOCK 8192     // records in a full block of an exported stream
+long num_tasks = 0;         // num of tasks used
 
 // define the struct for an entry in our storage
 typedef struct task_entry {
     const char *key;
     task *task_ptr;
+    long id;                // numeric value of key
 } task_entry;
 
-task_entry *data;   // array where data will be stored
+// entries live in fixed size segments so that growing the store never
+// moves an entry (STORE hands out pointers to them)
+task_entry **data;          // directory of segments where data will be stored
+long num_segments = 0;      // segments allocated
+long max_segments = 0;      // capacity of the directory
 
-// Will initialize the data storage
-void *init(){
-    data = (task_entry *) malloc(MAXSIZE*sizeof(task_entry));
+// keys are indexed by their numeric value; small stores keep them in a
+// dense array that LOCATE searches with SIMD compares (8 keys per AVX2
+// compare, 4 per SSE2 compare), larger ones in an open addressing hash
+// table; a key is only ever indexed at its first STORE
+typedef struct {
+    long id;
+    long index;             // entry holding the key, -1 if the slot is free
+} hash_slot;
+
+int32_t *compact_keys;      // compact layout: key of the i-th entry
+int hashed = 0;             // set once the store switched to the hash table
+hash_slot *hash_table;      // hashed layout
+long hash_size = 0;         // slots, a power of two
+long hash_used = 0;         // slots holding a key
+
+// LOCATE first asks a blocked Bloom filter whether the key may have been
+// stored; all bits of a key fall in one cache line, so a miss costs one
+// hash and one memory access and never touches the stored entries
+typedef struct {
+    uint64_t word[BLOOM_WORDS];
+} __attribute__((aligned(CACHELINE))) bloom_block;
+
+bloom_block *bloom;         // the filter blocks
+long bloom_blocks = 0;      // number of blocks
+long bloom_capacity = 0;    // keys the filter is sized for
+int bloom_k = 0;            // bits set per key
+int bloom_bits_per_key = 0;
+long bloom_rejects = 0;     // LOCATEs answered by the filter alone
+
+// Will return the i-th stored entry
+static task_entry *entry_at(long i){
+    return data[i / SEGSIZE] + i % SEGSIZE;
+}
+
+// Will hash a key
+static uint64_t key_hash(long id){
+    uint64_t h = (uint64_t) id;                 // splitmix64 finalizer
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+// Will parse the numeric key at the start of s and point end past it;
+// returns -1 unless s starts with a number followed by a space or the end
+static int parse_key(const char *s, long *id, char **end){
+    errno = 0;
+    *id = strtol(s, end, 10);
+    if (*end == s || errno) return -1;
+    if (**end && **end != ' ') return -1;
+    return 0;
+}
+
+// Will pick the block for a hash and the bits to set or test in it
+static bloom_block *bloom_bits(uint64_t h, uint64_t mask[BLOOM_WORDS]){
+    uint32_t h1 = (uint32_t) h;
+    uint32_t h2 = (uint32_t) (h >> 32) | 1;
+    memset(mask, 0, BLOOM_WORDS*sizeof(uint64_t));
+    for (int i = 0; i < bloom_k; i++) {
+        uint32_t bit = (h1 + i*h2) % (BLOOM_WORDS*64);
+        mask[bit / 64] |= 1ULL << (bit % 64);
+    }
+    return bloom + (long) (((h >> 32) * (uint64_t) bloom_blocks) >> 32);
+}
+
+static void bloom_add(long id){
+    uint64_t mask[BLOOM_WORDS];
+    bloom_block *b = bloom_bits(key_hash(id), mask);
+    for (int i = 0; i < BLOOM_WORDS; i++)
+        b->word[i] |= mask[i];
+}
+
+// Will return 0 only if the key was certainly never stored
+static int bloom_may_contain(long id){
+    uint64_t mask[BLOOM_WORDS];
+    bloom_block *b = bloom_bits(key_hash(id), mask);
+    uint64_t missing = 0;
+    for (int i = 0; i < BLOOM_WORDS; i++)
+        missing |= mask[i] & ~b->word[i];
+    return !missing;
+}
+
+// Will (re)build the filter for capacity keys and add the stored keys
+static int bloom_build(long capacity){
+    long blocks = (capacity * bloom_bits_per_key + BLOOM_WORDS*64 - 1) / (BLOOM_WORDS*64);
+    bloom_block *b = (bloom_block *) aligned_alloc(CACHELINE, blocks*sizeof(bloom_block));
+    if (!b) return -1;
+    memset(b, 0, blocks*sizeof(bloom_block));
+    free(bloom);
+    bloom = b;
+    bloom_blocks = blocks;
+    bloom_capacity = capacity;
+    for (long i = 0; i < num_tasks; i++)
+        bloom_add(entry_at(i)->id);
+    return 0;
+}
+
+// Will size the filter for a false positive rate: k = log2(1/fpr) bits
+// per key and k/ln(2) bits of filter per key, plus one to make up for
+// confining each key to a single block
+static int bloom_init(double fpr){
+    if (!(fpr > 0 && fpr < 1)) fpr = BLOOM_FPR;
+    for (bloom_k = 0; fpr < 1 && bloom_k < BLOOM_MAXK; bloom_k++)
+        fpr *= 2;
+    if (bloom_k == 0) bloom_k = 1;
+    bloom_bits_per_key = (bloom_k * 1477 + 1023) / 1024 + 1;
+    return bloom_build(SEGSIZE);
+}
+
+// Will search the compact array for the first entry with a key
+static long compact_find(long id){
+    if (id < INT32_MIN || id > INT32_MAX) return -1;
+    int32_t key = (int32_t) id;
+    long i = 0;
+#if defined(__AVX2__)
+    __m256i k = _mm256_set1_epi32(key);
+    for (; i + 16 <= num_tasks; i += 16) {
+        __m256i lo = _mm256_cmpeq_epi32(k, _mm256_load_si256((const __m256i *) (compact_keys + i)));
+        __m256i hi = _mm256_cmpeq_epi32(k, _mm256_load_si256((const __m256i *) (compact_keys + i + 8)));
+        unsigned m = (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(lo))
+                   | (unsigned) _mm256_movemask_ps(_mm256_castsi256_ps(hi)) << 8;
+        if (m) return i + __builtin_ctz(m);
+    }
+#elif defined(__SSE2__)
+    __m128i k = _mm_set1_epi32(key);
+    for (; i + 8 <= num_tasks; i += 8) {
+        __m128i lo = _mm_cmpeq_epi32(k, _mm_load_si128((const __m128i *) (compact_keys + i)));
+        __m128i hi = _mm_cmpeq_epi32(k, _mm_load_si128((const __m128i *) (compact_keys + i + 4)));
+        unsigned m = (unsigned) _mm_movemask_ps(_mm_castsi128_ps(lo))
+                   | (unsigned) _mm_movemask_ps(_mm_castsi128_ps(hi)) << 4;
+        if (m) return i + __builtin_ctz(m);
+    }
+#endif
+    for (; i < num_tasks; i++)
+        if (compact_keys[i] == key) return i;
+    return -1;
+}
+
+// Will return the slot holding a key, or the free slot where it belongs
+static hash_slot *hash_probe(long id){
+    long mask = hash_size - 1;
+    long i = (long) (key_hash(id) & mask);
+    while (hash_table[i].index >= 0 && hash_table[i].id != id)
+        i = (i + 1) & mask;
+    return hash_table + i;
+}
+
+static void hash_add(long id, long index){
+    hash_slot *slot = hash_probe(id);
+    if (slot->index >= 0) return;               // keep the first STORE of a key
+    slot->id = id;
+    slot->index = index;
+    hash_used += 1;
+}
+
+// Will (re)build the hash table with size slots from the stored entries
+static int hash_build(long size){
+    hash_slot *table = (hash_slot *) malloc(size*sizeof(hash_slot));
+    if (!table) return -1;
+    for (long i = 0; i < size; i++)
+        table[i].index = -1;
+    free(hash_table);
+    hash_table = table;
+    hash_size = size;
+    hash_used = 0;
+    for (long i = 0; i < num_tasks; i++)
+        hash_add(entry_at(i)->id, i);
+    return 0;
+}
+
+// Will index the key of the entry about to become the i-th, switching
+// to the hash table when the compact array is full or cannot hold the key
+static int index_add(long id, long i){
+    if (!hashed) {
+        if (i < COMPACT_MAX && id >= INT32_MIN && id <= INT32_MAX) {
+            compact_keys[i] = (int32_t) id;
+            return 0;
+        }
+        long size = 64;
+        while (size < 4*COMPACT_MAX) size *= 2;
+        if (hash_build(size)) return -1;
+        hashed = 1;
+    }
+    if (2*(hash_used + 1) > hash_size && hash_build(2*hash_size)) return -1;
+    hash_add(id, i);
+    return 0;
+}
+
+// Will return the index of the first entry stored with a key, or -1
+static long index_find(long id){
+    if (!hashed) return compact_find(id);
+    return hash_probe(id)->index;
+}
+
+// Will make room for one more entry, adding a segment when the last one is full
+static int grow(){
+    if (num_tasks < num_segments * SEGSIZE) return 0;
+    if (num_segments == max_segments) {
+        task_entry **dir = (task_entry **) realloc(data, 2*max_segments*sizeof(task_entry *));
+        if (!dir) return -1;
+        data = dir;
+        max_segments *= 2;
+    }
+    data[num_segments] = (task_entry *) malloc(SEGSIZE*sizeof(task_entry));
+    if (!data[num_segments]) return -1;
+    num_segments += 1;
+    return 0;
+}
+
+// stored copies live until the next INIT, so they are carved out of large
+// chunks instead of being allocated one by one; the first 16 bytes of a
+// chunk link it to the previous one so INIT can free them all
+#define ARENA_LINK 16
+char *arena_chunks;         // most recently allocated chunk
+char *arena_next;           // free space in the current chunk
+size_t arena_left = 0;
+
+static void *arena_alloc(size_t size){
+    size = (size + 15) & ~(size_t) 15;
+    if (size > arena_left) {
+        char *chunk = (char *) malloc(ARENA_CHUNK);
+        if (!chunk) {
+            arena_left = 0;
+            return NULL;
+        }
+        *(char **) chunk = arena_chunks;
+        arena_chunks = chunk;
+        arena_next = chunk + ARENA_LINK;
+        arena_left = ARENA_CHUNK - ARENA_LINK;
+    }
+    void *p = arena_next;
+    arena_next += size;
+    arena_left -= size;
+    return p;
+}
+
+static void arena_free(){
+    while (arena_chunks) {
+        char *prev = *(char **) arena_chunks;
+        free(arena_chunks);
+        arena_chunks = prev;
+    }
+    arena_next = NULL;
+    arena_left = 0;
+}
+
+// Will initialize the data storage, dropping whatever an earlier INIT
+// stored; parm optionally gives the false positive rate of the LOCATE filter
+void *init(char *parm){
+    for (long i = 0; i < num_segments; i++)
+        free(data[i]);
+    free(data);
+    data = NULL;
+    num_segments = 0;
+    max_segments = 0;
+    free(hash_table);
+    hash_table = NULL;
+    hash_size = 0;
+    hash_used = 0;
+    arena_free();
+    num_tasks = 0;
+    hashed = 0;
+    if (bloom_init(parm ? strtod(parm, NULL) : BLOOM_FPR)) return NULL;
+    if (!compact_keys)
+        compact_keys = (int32_t *) aligned_alloc(CACHELINE, (COMPACT_MAX/16 + 1)*16*sizeof(int32_t));
+    if (!compact_keys) return NULL;
+    data = (task_entry **) malloc(sizeof(task_entry *));
+    if (!data) return NULL;
+    data[0] = (task_entry *) malloc(SEGSIZE*sizeof(task_entry));
+    if (!data[0]) {
+        free(data);
+        data = NULL;
+        return NULL;
+    }
+    num_segments = 1;
+    max_segments = 1;
     return data;
 }
 
-// Will store a deep copy of a task in our data structure
-void *store(char *parm, task *ptr){
-    if (!data) return NULL;                     // check if init is called
-    if (!ptr) return NULL;
-    if (num_tasks == MAXSIZE - 1) return NULL;  // check maximum size exceeded
+// Will add a deep copy of a task under a key that has been parsed to id
+static task_entry *insert(const char *key, long id, task *ptr){
+    if (grow()) return NULL;                    // check storage is available
+    if (num_tasks == bloom_capacity && bloom_build(2*bloom_capacity)) return NULL;
 
     // copy task
     task *my_task;
-    my_task = (task *) malloc(sizeof(task));
+    my_task = (task *) arena_alloc(sizeof(task));
+    if (!my_task) return NULL;
     *my_task = *ptr;
     // copy FS
     if (my_task->fs_ptr){
         FS *my_fs;
-        my_fs = (FS *) malloc(sizeof(FS));
+        my_fs = (FS *) arena_alloc(sizeof(FS));
+        if (!my_fs) return NULL;
         *my_fs = *(my_task->fs_ptr);
         my_task->fs_ptr = my_fs;
     }
     // copy VM
     if (my_task->vm_ptr){
         VM *my_vm;
-        my_vm = (VM *) malloc(sizeof(VM));
+        my_vm = (VM *) arena_alloc(sizeof(VM));
+        if (!my_vm) return NULL;
         *my_vm = *(my_task->vm_ptr);
         my_task->vm_ptr = my_vm;
         // copy paged
         if (my_vm->paged_ptr){
             paged *my_paged;
-            my_paged = (paged *) malloc(sizeof(paged));
+            my_paged = (paged *) arena_alloc(sizeof(paged));
+            if (!my_paged) return NULL;
             *my_paged = *(my_vm->paged_ptr);
             my_vm->paged_ptr = my_paged;
         }
         // copy pinned
         if (my_vm->pinned_ptr){
             pinned *my_pinned;
-            my_pinned = (pinned *) malloc(sizeof(pinned));
+            my_pinned = (pinned *) arena_alloc(sizeof(pinned));
+            if (!my_pinned) return NULL;
             *my_pinned = *(my_vm->pinned_ptr);
             my_vm->pinned_ptr = my_pinned;
         }
     }
     // add our copied task into our array
-    task_entry new_entry = {.key = parm, .task_ptr = my_task};
-    *(data+num_tasks) = new_entry;
+    if (index_add(id, num_tasks)) return NULL;
+    task_entry new_entry = {.key = key, .task_ptr = my_task, .id = id};
+    *entry_at(num_tasks) = new_entry;
+    bloom_add(id);
     num_tasks += 1;
-    return data+num_tasks-1;
+    return entry_at(num_tasks-1);
+}
+
+// Will store a deep copy of a task in our data structure
+void *store(char *parm, task *ptr){
+    if (!data) return NULL;                     // check if init is called
+    if (!ptr || !parm) return NULL;
+    long id;
+    char *end;
+    if (parse_key(parm, &id, &end)) return NULL;    // keys must be numeric
+    return insert(parm, id, ptr);
 }
 
 // Will locate a task in our data structure and return requested field
 void *locate(char *parm){
     if (!data) return NULL;                     // check if init is called
-    
-    // tokenize the parm string
-    char *copy = strdup(parm);
-    char *key;
-    char *field;
-    key = strtok(copy, " ");
-    field = strtok(NULL, " ");
-    if (!key) return NULL;
-    if (!field) return NULL;
+    if (!parm) return NULL;
 
-    // find the key in our data structure
-    task_entry *found = NULL;
-    for (int i = 0; i < num_tasks; i++) {
-        if (!strcmp((data+i)->key, key)) {
-            found = data+i;
-            break;
-        }
+    // split the parm string into the key and the field name
+    long id;
+    char *end;
+    char field[MAXFIELD];
+    if (parse_key(parm, &id, &end)) return NULL;
+    if (!bloom_may_contain(id)) {               // key was never stored
+        bloom_rejects += 1;
+        return NULL;
     }
-    if (!found) return NULL;
+    while (*end == ' ') end++;
+    size_t len = strcspn(end, " ");
+    if (len == 0 || len >= MAXFIELD) return NULL;
+    memcpy(field, end, len);
+    field[len] = '\0';
+
+    // find the key in our data structure
+    long i = index_find(id);
+    if (i < 0) return NULL;
+    task_entry *found = entry_at(i);
     if (!found->task_ptr) return NULL;
 
     // find the field in our found entry and return the address
@@ -119,16 +439,375 @@ void *locate(char *parm){
     return NULL;
 }
 
+// An exported stream is a header followed by blocks of at most WIRE_BLOCK
+// records and an empty block that ends it, all in host byte order:
+//   header: u32 magic, u32 version
+//   block:  u32 length (bytes after this field), u32 count, then one
+//           column per field, each count values long:
+//           i64 key, i64 pid, i64 inode_start, i64 inode_end,
+//           u64 paged_start, u64 paged_end, u64 pinned_start, u64 pinned_end,
+//           u8 present (WIRE_FS | WIRE_VM | WIRE_PAGED | WIRE_PINNED)
+// Fields of missing structures are zero.  Blocks are built and parsed in
+// one buffer, so moving a record costs no allocation beyond the store's.
+enum {WIRE_FS = 1, WIRE_VM = 2, WIRE_PAGED = 4, WIRE_PINNED = 8};
+#define WIRE_COLUMNS 8      // 64-bit columns in a block
+#define WIRE_RECORD (WIRE_COLUMNS*sizeof(uint64_t) + 1)
+
+long wire_records;          // records moved by the last EXPORT or IMPORT
+
+// Will write or read all len bytes, retrying short transfers
+static int write_full(int fd, const void *buf, size_t len){
+    const char *p = (const char *) buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len){
+    char *p = (char *) buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Will write a block of count records whose columns start at buf + 8
+static int flush_block(int fd, uint64_t *buf, uint32_t count){
+    uint32_t *head = (uint32_t *) buf;
+    uint64_t *col = buf + 1;
+    uint8_t *present = (uint8_t *) (col + WIRE_COLUMNS*count);
+    // the columns were filled WIRE_BLOCK apart; close the gaps
+    for (int c = 1; c < WIRE_COLUMNS; c++)
+        memmove(col + c*count, col + c*WIRE_BLOCK, count*sizeof(uint64_t));
+    memmove(present, col + WIRE_COLUMNS*WIRE_BLOCK, count);
+    head[0] = (uint32_t) (sizeof(uint32_t) + count*WIRE_RECORD);
+    head[1] = count;
+    return write_full(fd, buf, 2*sizeof(uint32_t) + count*WIRE_RECORD);
+}
+
+// Will write the stored tasks, or those with keys in [first, last], to fd
+void *export(char *parm){
+    if (!data || !parm) return NULL;
+    int fd;
+    long first = LONG_MIN, last = LONG_MAX;
+    int n = sscanf(parm, "%d %ld %ld", &fd, &first, &last);
+    if (n != 1 && n != 3) return NULL;
+
+    uint32_t header[2] = {WIRE_MAGIC, WIRE_VERSION};
+    uint64_t *buf = (uint64_t *) malloc(sizeof(uint64_t) + WIRE_BLOCK*WIRE_RECORD);
+    if (!buf) return NULL;
+    if (write_full(fd, header, sizeof(header))) goto fail;
+
+    uint64_t *col = buf + 1;
+    uint8_t *present = (uint8_t *) (col + WIRE_COLUMNS*WIRE_BLOCK);
+    uint32_t count = 0;
+    wire_records = 0;
+    for (long i = 0; i < num_tasks; i++) {
+        task_entry *e = entry_at(i);
+        if (e->id < first || e->id > last) continue;
+        task *t = e->task_ptr;
+        uint64_t row[WIRE_COLUMNS] = {(uint64_t) e->id, (uint64_t) t->pid};
+        uint8_t has = 0;
+        if (t->fs_ptr) {
+            has |= WIRE_FS;
+            row[2] = (uint64_t) t->fs_ptr->inode_start;
+            row[3] = (uint64_t) t->fs_ptr->inode_end;
+        }
+        if (t->vm_ptr) {
+            has |= WIRE_VM;
+            if (t->vm_ptr->paged_ptr) {
+                has |= WIRE_PAGED;
+                row[4] = (uint64_t) t->vm_ptr->paged_ptr->paged_start;
+                row[5] = (uint64_t) t->vm_ptr->paged_ptr->paged_end;
+            }
+            if (t->vm_ptr->pinned_ptr) {
+                has |= WIRE_PINNED;
+                row[6] = (uint64_t) t->vm_ptr->pinned_ptr->pinned_start;
+                row[7] = (uint64_t) t->vm_ptr->pinned_ptr->pinned_end;
+            }
+        }
+        for (int c = 0; c < WIRE_COLUMNS; c++)
+            col[c*WIRE_BLOCK + count] = row[c];
+        present[count] = has;
+        wire_records += 1;
+        if (++count == WIRE_BLOCK) {
+            if (flush_block(fd, buf, count)) goto fail;
+            count = 0;
+        }
+    }
+    if (count > 0 && flush_block(fd, buf, count)) goto fail;
+    if (flush_block(fd, buf, 0)) goto fail;     // end of stream
+    free(buf);
+    return &wire_records;
+fail:
+    free(buf);
+    return NULL;
+}
+
+// Will format a key for an imported task; keys live as long as the store
+static char *make_key(long id){
+    char digits[24];
+    int n = 0;
+    unsigned long v = id < 0 ? -(unsigned long) id : (unsigned long) id;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    char *key = (char *) arena_alloc(n + 2);
+    if (!key) return NULL;
+    char *p = key;
+    if (id < 0) *p++ = '-';
+    while (n > 0) *p++ = digits[--n];
+    *p = '\0';
+    return key;
+}
+
+// Will store every task of a stream read from fd
+void *import(char *parm){
+    if (!data || !parm) return NULL;
+    int fd;
+    if (sscanf(parm, "%d", &fd) != 1) return NULL;
+
+    uint32_t header[2];
+    if (read_full(fd, header, sizeof(header))) return NULL;
+    if (header[0] != WIRE_MAGIC || header[1] != WIRE_VERSION) return NULL;
+    uint64_t *buf = (uint64_t *) malloc(sizeof(uint64_t) + WIRE_BLOCK*WIRE_RECORD);
+    if (!buf) return NULL;
+
+    wire_records = 0;
+    for (;;) {
+        uint32_t *head = (uint32_t *) buf;
+        if (read_full(fd, head, sizeof(uint32_t))) goto fail;
+        if (head[0] < sizeof(uint32_t) || head[0] > sizeof(uint32_t) + WIRE_BLOCK*WIRE_RECORD) goto fail;
+        if (read_full(fd, head + 1, head[0])) goto fail;
+        uint32_t count = head[1];
+        if (head[0] != sizeof(uint32_t) + count*WIRE_RECORD) goto fail;
+        if (count == 0) break;                  // end of stream
+
+        uint64_t *col = buf + 1;
+        uint8_t *present = (uint8_t *) (col + WIRE_COLUMNS*count);
+        for (uint32_t r = 0; r < count; r++) {
+            long id = (long) col[r];
+            paged my_paged = {(void *) col[4*count + r], (void *) col[5*count + r]};
+            pinned my_pinned = {(void *) col[6*count + r], (void *) col[7*count + r]};
+            VM my_vm = {present[r] & WIRE_PAGED ? &my_paged : NULL,
+                        present[r] & WIRE_PINNED ? &my_pinned : NULL};
+            FS my_fs = {(long) col[2*count + r], (long) col[3*count + r]};
+            task my_task = {(long) col[count + r],
+                            present[r] & WIRE_VM ? &my_vm : NULL,
+                            present[r] & WIRE_FS ? &my_fs : NULL};
+            char *key = make_key(id);
+            if (!key || !insert(key, id, &my_task)) goto fail;
+            wire_records += 1;
+        }
+    }
+    free(buf);
+    return &wire_records;
+fail:
+    free(buf);
+    return NULL;
+}
+
+// a scan worker owns a contiguous range of grains; once its own range is
+// drained it steals the remaining grains of the other workers one at a time
+typedef struct scan_worker {
+    atomic_long next;       // next grain to hand out from this range
+    long end;               // one past the last grain of this range
+    struct scan_job *job;
+    void *partial;          // this worker's partial result
+} __attribute__((aligned(CACHELINE))) scan_worker;
+
+// the state shared by all workers of one for_each or reduce call
+typedef struct scan_job {
+    scan_worker *workers;
+    int num_workers;
+    task_visit visit;       // for_each callback and its argument
+    void *arg;
+    task_accumulate fold;   // reduce callbacks
+    task_combine combine;
+} scan_job;
+
+// Will hand out the next grain from a worker's range, or -1 when it is drained
+static long take_grain(scan_worker *w){
+    long g = atomic_fetch_add_explicit(&w->next, 1, memory_order_relaxed);
+    return g < w->end ? g : -1;
+}
+
+// Will walk one grain of entries; grains never straddle a segment
+static void scan_grain(scan_job *job, void *partial, long g){
+    long first = g * GRAIN;
+    long last = first + GRAIN < num_tasks ? first + GRAIN : num_tasks;
+    task_entry *e = entry_at(first);
+    for (long i = first; i < last; i++, e++) {
+        if (job->visit) job->visit(e->key, e->task_ptr, job->arg);
+        else job->fold(partial, e->key, e->task_ptr);
+    }
+}
+
+// Will drain a worker's own range and then steal from the others
+static void *scan_worker_main(void *arg){
+    scan_worker *self = (scan_worker *) arg;
+    scan_job *job = self->job;
+    long g;
+    while ((g = take_grain(self)) >= 0)
+        scan_grain(job, self->partial, g);
+    for (int i = 1; i < job->num_workers; i++) {
+        scan_worker *victim = job->workers + (self - job->workers + i) % job->num_workers;
+        while ((g = take_grain(victim)) >= 0)
+            scan_grain(job, self->partial, g);
+    }
+    return NULL;
+}
+
+// the worker threads are started by the first parallel scan and then stay
+// parked on a condition variable between scans, so a for_each or reduce
+// costs a broadcast and a wait rather than a thread creation per worker;
+// pool thread i runs worker i + 1 of each job, if the job has one
+typedef struct scan_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    // a job was posted
+    pthread_cond_t idle;    // the last pool thread finished the job
+    pthread_mutex_t run;    // scans use the pool one at a time
+    scan_job *job;
+    long generation;        // jobs posted so far
+    int pending;            // pool threads still on the current job
+    int num_threads;
+    int started;            // set once the threads have been created
+} scan_pool;
+
+static scan_pool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER,
+    .run = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void *pool_main(void *arg){
+    int worker = (int) (intptr_t) arg;
+    long seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen)
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        seen = pool.generation;
+        scan_job *job = pool.job;
+        pthread_mutex_unlock(&pool.lock);
+        if (worker < job->num_workers)
+            scan_worker_main(job->workers + worker);
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.pending == 0)
+            pthread_cond_signal(&pool.idle);
+    }
+    return NULL;
+}
+
+// Will start up to n - 1 pool threads; called with pool.run held
+static void pool_start(int n){
+    pthread_mutex_lock(&pool.lock);
+    for (int i = 1; i < n; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_main, (void *) (intptr_t) i)) break;
+        pthread_detach(thread);
+        pool.num_threads += 1;
+    }
+    pool.started = 1;
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// Will partition the store across the pool and run the job, leaving each
+// worker's result in its partial; the calling thread is worker 0 and the
+// ranges of workers without a pool thread are left to be stolen
+static int scan(scan_job *job, void *acc, size_t acc_size){
+    long num_grains = (num_tasks + GRAIN - 1) / GRAIN;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = num_grains <= SERIAL_SCAN ? 1 : (int) (cpus < 1 ? 1 : cpus);
+    if (n > MAXTHREADS) n = MAXTHREADS;
+    if (n > num_grains) n = num_grains > 0 ? (int) num_grains : 1;
+
+    size_t stride = (acc_size + CACHELINE - 1) / CACHELINE * CACHELINE;
+    scan_worker *workers = (scan_worker *) aligned_alloc(CACHELINE, n*sizeof(scan_worker));
+    char *partials = stride ? (char *) aligned_alloc(CACHELINE, n*stride) : NULL;
+    if (!workers || (stride && !partials)) {
+        free(workers);
+        free(partials);
+        return -1;
+    }
+    job->workers = workers;
+    job->num_workers = n;
+    for (int i = 0; i < n; i++) {
+        atomic_init(&workers[i].next, num_grains * i / n);
+        workers[i].end = num_grains * (i + 1) / n;
+        workers[i].job = job;
+        workers[i].partial = stride ? partials + i*stride : NULL;
+        if (stride) memcpy(workers[i].partial, acc, acc_size);  // start from the identity
+    }
+
+    if (n == 1) {
+        scan_worker_main(workers);
+    } else {
+        pthread_mutex_lock(&pool.run);
+        if (!pool.started) pool_start(cpus < MAXTHREADS ? (int) cpus : MAXTHREADS);
+        pthread_mutex_lock(&pool.lock);
+        pool.job = job;
+        pool.pending = pool.num_threads;
+        pool.generation += 1;
+        pthread_cond_broadcast(&pool.wake);
+        pthread_mutex_unlock(&pool.lock);
+        scan_worker_main(workers);
+        pthread_mutex_lock(&pool.lock);
+        while (pool.pending > 0)
+            pthread_cond_wait(&pool.idle, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+        pthread_mutex_unlock(&pool.run);
+    }
+
+    if (job->fold)
+        for (int i = 0; i < n; i++)
+            job->combine(acc, workers[i].partial);
+    free(partials);
+    free(workers);
+    return 0;
+}
+
+// Will call fn for every stored task, spreading the calls over several threads
+int task_store_for_each(task_visit fn, void *arg){
+    if (!data || !fn) return -1;                // check if init is called
+    scan_job job = {.visit = fn, .arg = arg};
+    return scan(&job, NULL, 0);
+}
+
+// Will fold every stored task into acc; each thread folds its share into a
+// private copy of acc's initial (identity) value and the copies are then
+// combined into acc
+int task_store_reduce(void *acc, size_t acc_size, task_accumulate fold, task_combine combine){
+    if (!data || !acc || !acc_size || !fold || !combine) return -1;
+    scan_job job = {.fold = fold, .combine = combine};
+    return scan(&job, acc, acc_size);
+}
+
 
-// Will perform one of three operations on a task structure:
+// Will perform one of five operations on a task structure:
 //      1 initialize data structures associated with task_store
 //      2 store a copy of a task structure
 //      3 return a pointer to an element of a previously stored copy of a task
+//      4 export the stored tasks to a file descriptor
+//      5 import tasks exported earlier from a file descriptor
 void *task_store(enum operation op, char *parm, task *ptr){
     switch(op){
-        case INIT: return init();
+        case INIT: return init(parm);
         case STORE: return store(parm, ptr);
         case LOCATE: return locate(parm);
+        case EXPORT: return export(parm);
+        case IMPORT: return import(parm);
         default: break;
     }
     return NULL;
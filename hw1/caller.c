@@ -6,6 +6,20 @@
  * process, and outputs the result.  It also outputs the 
  * result from the regular Linux getpinfo() system call so the
  * two results can be compared.
+ *
+ * Any arguments are passed on as options of the call, e.g.
+ * "caller all", "caller binary tree 1", "caller pids 1 2 3" or
+ * "caller binary all since 0".  With "sample <period_us>" it
+ * lets the module sample for a second, then drains the samples.
+ * With "watch <field> <threshold>" it waits in poll() for up to a
+ * minute for a watch to fire, then prints the fired watches.
+ * A first argument of "async" is not passed on; it opens the file
+ * with O_NONBLOCK and waits for each call's response in poll().
+ * With "binary" it requests binary records and prints them as a
+ * table.  With "ring" it has the records published in the module's
+ * ring and reads them from a mapping.  An argument of "check" is
+ * not passed on either; after the call it makes an invalid call and
+ * then a plain one, checking that each gets its own whole response.
  */
 
 #include <stdlib.h>
@@ -17,21 +31,30 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <poll.h>
 
 #include "getpinfo.h" /* used by both kernel module and user program */
 
-void do_syscall(char *call_string);  // does the call emulation
+int do_syscall(char *call_string);  // does the call emulation
+void print_records(int len);        // prints a binary response
+void print_ticks(int len);          // prints drained samples
+void print_events(int len);         // prints fired watches
+int read_ring(struct pinfo_ring *ring);  // copies the latest snapshot
 
 // variables shared between main() and the do_syscall() function
 int fp;
 char the_file[256] = "/sys/kernel/debug/";
-char call_buf[MAX_CALL];  /* no call string can be longer */
-char resp_buf[MAX_ENTRY * MAX_SIBLINGS];  /* no response string can be longer */
+char call_buf[MAX_PIDS_CALL];  /* no call string can be longer */
+char *resp_buf;      /* grows to hold the whole response */
+size_t resp_size;
+int nonblock;        /* calls run asynchronously */
 
 void main (int argc, char* argv[])
 {
-  int i;
+  int i, first = 1;
   int rc = 0;
+  int binary = 0, ring_mode = 0, sampling = 0, watching = 0, checking = 0;
   pid_t my_pid;  
 
   /* Build the complete file path name and open the file */
@@ -40,7 +63,11 @@ void main (int argc, char* argv[])
   strcat(the_file, "/");
   strcat(the_file, file_name);
 
-  if ((fp = open (the_file, O_RDWR)) == -1) {
+  if (argc > 1 && strcmp(argv[1], "async") == 0) {
+      nonblock = 1;
+      first = 2;
+  }
+  if ((fp = open (the_file, nonblock ? O_RDWR | O_NONBLOCK : O_RDWR)) == -1) {
       fprintf (stderr, "error opening %s\n", the_file);
       exit (-1);
   }
@@ -49,10 +76,86 @@ void main (int argc, char* argv[])
   //my_pid = getpid();
   //fprintf(stdout, "System call getpinfo() returns %d\n", my_pid);
 
+  // build the call string from the options given
+  strcpy(call_buf, "getpinfo");
+  for (i = first; i < argc; i++) {
+      if (strcmp(argv[i], "check") == 0) {
+          checking = 1;
+          continue;
+      }
+      if (strlen(call_buf) + strlen(argv[i]) + 2 > sizeof(call_buf)) {
+          fprintf (stderr, "call string too long\n");
+          exit (-1);
+      }
+      strcat(call_buf, " ");
+      strcat(call_buf, argv[i]);
+      if (strcmp(argv[i], "binary") == 0)
+          binary = 1;
+      else if (strcmp(argv[i], "ring") == 0)
+          ring_mode = 1;
+      else if (strcmp(argv[i], "sample") == 0 && i + 1 < argc)
+          sampling = atoi(argv[i + 1]) != 0;
+      else if (strcmp(argv[i], "watch") == 0)
+          watching = 1;
+  }
+
+  resp_size = MAX_ENTRY * MAX_SIBLINGS;
+  if ((resp_buf = malloc(resp_size)) == NULL) {
+      fprintf (stderr, "out of memory\n");
+      exit (-1);
+  }
+
   // use the kernel module to get the pid
-  do_syscall("getpinfo");
+  if (ring_mode) {
+      struct pinfo_ring *ring;
+
+      ring = mmap(NULL, PINFO_RING_SIZE, PROT_READ, MAP_SHARED, fp, 0);
+      if (ring == MAP_FAILED) {
+          fprintf (stderr, "error mapping %s\n", the_file);
+          exit (-1);
+      }
+      do_syscall(call_buf);  // nothing is returned by read()
+      print_records(read_ring(ring));
+      munmap(ring, PINFO_RING_SIZE);
+  }
+  else if (binary) {
+      rc = do_syscall(call_buf);
+      print_records(rc);
+  }
+  else {
+      do_syscall(call_buf);
+      fprintf(stdout, "%s", resp_buf);
+  }
 
-  fprintf(stdout, "%s", resp_buf);
+  if (checking) { // an invalid call must not leave the last one's offset
+      const char *failed = "Failed: invalid operation\n";
+
+      rc = do_syscall("getpinfo no-such-option");
+      if (rc != strlen(failed) + 1 || strcmp(resp_buf, failed) != 0)
+          fprintf(stdout, "check: invalid call returned %d bytes: %.*s\n", rc, rc, resp_buf);
+      else if (do_syscall("getpinfo") <= 0 || strncmp(resp_buf, "Failed", 6) == 0)
+          fprintf(stdout, "check: call after an invalid call failed\n");
+      else
+          fprintf(stdout, "check: invalid call after a valid one success\n");
+  }
+
+  if (sampling) { // the samples are lost when the file is closed
+      sleep(1);
+      print_ticks(do_syscall("getpinfo drain"));
+  }
+  if (watching) { // the watches are removed when the file is closed
+      struct pollfd pfd = { .fd = fp, .events = POLLPRI };
+
+      rc = poll(&pfd, 1, 60 * 1000);
+      if (rc == -1) {
+          fprintf (stderr, "error polling %s\n", the_file);
+          exit (-1);
+      }
+      if (rc == 0)
+          fprintf(stdout, "no watch fired\n");
+      else
+          print_events(do_syscall("getpinfo watches"));
+  }
 
   close (fp);
 } /* end main() */
@@ -68,14 +171,18 @@ void main (int argc, char* argv[])
  * The input string should be properly formatted for the
  * call string expected by the kernel module using the
  * specified debugfs path (this function does no error
- * checking of input).
+ * checking of input).  The response is read in as many read()
+ * calls as it takes, growing resp_buf as needed.  It returns the
+ * length of the response.
  */ 
 
-void do_syscall(char *call_string)
+int do_syscall(char *call_string)
 {
   int rc;
+  size_t len = 0;
 
-  strcpy(call_buf, call_string);
+  if (call_string != call_buf)
+     strcpy(call_buf, call_string);
 
   // TODO - man 2 write and man 2 read to get the return codes and define those in the module
   rc = write(fp, call_buf, strlen(call_buf) + 1);
@@ -85,11 +192,226 @@ void do_syscall(char *call_string)
      exit (-1);
   }
 
-  rc = read(fp, resp_buf, sizeof(resp_buf));
-  if (rc == -1) {
-     fprintf (stderr, "error reading %s\n", the_file);
-     fflush(stderr);
+  if (nonblock) { // other work could be done here; wait for the response
+     struct pollfd pfd = { .fd = fp, .events = POLLIN };
+
+     if (poll(&pfd, 1, -1) == -1) {
+        fprintf (stderr, "error polling %s\n", the_file);
+        fflush(stderr);
+        exit (-1);
+     }
+  }
+
+  do {
+     if (len == resp_size) {
+        resp_size *= 2;
+        if ((resp_buf = realloc(resp_buf, resp_size)) == NULL) {
+           fprintf (stderr, "out of memory\n");
+           exit (-1);
+        }
+     }
+     rc = read(fp, resp_buf + len, resp_size - len);
+     if (rc == -1) {
+        fprintf (stderr, "error reading %s\n", the_file);
+        fflush(stderr);
+        exit (-1);
+     }
+     len += rc;
+  } while (rc > 0);
+  return len;
+}
+
+/*
+ * A function to print the records of a binary response of len
+ * bytes, checking that the response has the expected layout.
+ * The VM column tells how the VM fields were sampled: L under the
+ * mm's lock, U without it, - not at all (no user memory).
+ */
+
+void print_records(int len)
+{
+  struct pinfo_header *hdr = (struct pinfo_header *)resp_buf;
+  struct pinfo_record *rec;
+  char *pos;
+  int i, pid;
+
+  if (len >= sizeof(*hdr) && (hdr->flags & PINFO_TICKS)) {
+     print_ticks(len);
+     return;
+  }
+  if (len >= sizeof(*hdr) && (hdr->flags & PINFO_EVENTS)) {
+     print_events(len);
+     return;
+  }
+  if (len < sizeof(*hdr) || hdr->magic != PINFO_MAGIC ||
+      hdr->rec_size < sizeof(*rec) +
+        (hdr->flags & PINFO_SCHED ? sizeof(struct pinfo_sched) : 0) +
+        (hdr->flags & PINFO_MEM ? sizeof(struct pinfo_mem) : 0) +
+        (hdr->flags & PINFO_IO ? sizeof(struct pinfo_io) : 0) ||
+      len < sizeof(*hdr) + (long)hdr->count * hdr->rec_size + 4L * hdr->nr_exited) {
+     fprintf (stderr, "invalid binary response (%d bytes)\n", len);
+     exit (-1);
+  }
+
+  fprintf(stdout, "%7s %7s %5s %10s %4s %5s %8s %8s %8s %8s %3s %5s %10s", "PID", "PPID",
+          "STATE", "FLAGS", "PRIO", "AREAS", "SHARED", "EXEC", "STACK", "TOTAL", "VM",
+          "THR", "CPU_MS");
+  if (hdr->flags & PINFO_SCHED)
+     fprintf(stdout, " %4s %3s %4s %10s", "CPU", "POL", "EPRI", "WAIT_MS");
+  if (hdr->flags & PINFO_MEM)
+     fprintf(stdout, " %8s %8s %8s %8s", "ANON", "FILE", "SHMEM", "MAJFLT");
+  if (hdr->flags & PINFO_IO)
+     fprintf(stdout, " %12s %12s %10s %10s", "READ", "WRITTEN", "RD_B/S", "WR_B/S");
+  fprintf(stdout, "\n");
+  pos = resp_buf + sizeof(*hdr);
+  for (i = 0; i < hdr->count; i++, pos += hdr->rec_size) {
+     rec = (struct pinfo_record *)pos;
+     fprintf(stdout, "%7d %7d %5lld 0x%08x %4d %5d %8llu %8llu %8llu %8llu %3s",
+             rec->pid, rec->ppid, (long long)rec->state, rec->flags,
+             rec->normal_prio, rec->map_count,
+             (unsigned long long)rec->shared_vm, (unsigned long long)rec->exec_vm,
+             (unsigned long long)rec->stack_vm, (unsigned long long)rec->total_vm,
+             rec->vm_sample == PINFO_VM_LOCKED ? "L" :
+             rec->vm_sample == PINFO_VM_LOCKLESS ? "U" : "-");
+     fprintf(stdout, " %5u %10llu", rec->nr_threads,
+             (unsigned long long)rec->runtime_ns / 1000000);
+     if (hdr->flags & PINFO_SCHED) {
+        struct pinfo_sched *sc = (struct pinfo_sched *)(pos + sizeof(*rec));
+
+        fprintf(stdout, " %4d %3u %4d %10llu", sc->cpu, sc->policy, sc->prio,
+                (unsigned long long)sc->run_delay_ns / 1000000);
+     }
+     if (hdr->flags & PINFO_MEM) {
+        struct pinfo_mem *mem = (struct pinfo_mem *)(pos + sizeof(*rec) +
+            (hdr->flags & PINFO_SCHED ? sizeof(struct pinfo_sched) : 0));
+
+        fprintf(stdout, " %8llu %8llu %8llu %8llu", (unsigned long long)mem->rss_anon,
+                (unsigned long long)mem->rss_file, (unsigned long long)mem->rss_shmem,
+                (unsigned long long)mem->maj_flt);
+     }
+     if (hdr->flags & PINFO_IO) {
+        struct pinfo_io *io = (struct pinfo_io *)(pos + sizeof(*rec) +
+            (hdr->flags & PINFO_SCHED ? sizeof(struct pinfo_sched) : 0) +
+            (hdr->flags & PINFO_MEM ? sizeof(struct pinfo_mem) : 0));
+
+        fprintf(stdout, " %12llu %12llu %10llu %10llu", (unsigned long long)io->rchar,
+                (unsigned long long)io->wchar, (unsigned long long)io->rchar_rate,
+                (unsigned long long)io->wchar_rate);
+     }
+     fprintf(stdout, "\n");
+  }
+  for (i = 0; i < hdr->nr_exited; i++, pos += sizeof(pid)) {
+     memcpy(&pid, pos, sizeof(pid));
+     fprintf(stdout, "%7d exited\n", pid);
+  }
+  if (hdr->generation != 0)
+     fprintf(stdout, "generation %llu%s\n", (unsigned long long)hdr->generation,
+             hdr->flags & PINFO_DELTA ? " (changes only)" : "");
+}
+
+
+/*
+ * A function to copy the latest snapshot published in the ring
+ * into resp_buf with plain loads, retrying if the module rewrote
+ * the slot while it was copied.  It returns the snapshot length.
+ */
+
+int read_ring(struct pinfo_ring *ring)
+{
+  struct pinfo_slot *slot;
+  unsigned long long n, seq;
+  int len;
+
+  do {
+     n = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+     if (n == 0)
+        return 0;  // nothing published yet
+     slot = PINFO_SLOT(ring, n);
+     seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+     len = slot->len;
+     if (len > PINFO_SLOT_SIZE - sizeof(*slot))
+        len = PINFO_SLOT_SIZE - sizeof(*slot);  // torn read; seq will not match
+     while (len > resp_size) {
+        resp_size *= 2;
+        if ((resp_buf = realloc(resp_buf, resp_size)) == NULL) {
+           fprintf (stderr, "out of memory\n");
+           exit (-1);
+        }
+     }
+     memcpy(resp_buf, slot + 1, len);
+     __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while (seq != 2 * n || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq);
+  return len;
+}
+
+
+/*
+ * A function to print the samples of a drain response of len
+ * bytes, checking that the response has the expected layout.
+ */
+
+void print_ticks(int len)
+{
+  struct pinfo_header *hdr = (struct pinfo_header *)resp_buf;
+  struct pinfo_tick *t;
+  char *pos;
+  int i;
+
+  if (len < sizeof(*hdr) || hdr->magic != PINFO_MAGIC ||
+      !(hdr->flags & PINFO_TICKS) || hdr->rec_size < sizeof(*t) ||
+      len < sizeof(*hdr) + (long)hdr->count * hdr->rec_size) {
+     fprintf (stderr, "invalid sample response (%d bytes)\n", len);
      exit (-1);
   }
+
+  fprintf(stdout, "%14s %7s %3s %5s %5s %8s %8s %12s %6s %6s %10s %10s\n", "TIME_NS", "PID",
+          "CPU", "STATE", "AREAS", "TOTAL", "STACK", "RUNTIME_NS", "VCSW", "IVCSW",
+          "RD_B/S", "WR_B/S");
+  pos = resp_buf + sizeof(*hdr);
+  for (i = 0; i < hdr->count; i++, pos += hdr->rec_size) {
+     t = (struct pinfo_tick *)pos;
+     fprintf(stdout, "%14llu %7d %3u %5lld %5d %8llu %8llu %12llu %6llu %6llu %10llu %10llu%s\n",
+             (unsigned long long)t->time_ns, t->pid, t->cpu, (long long)t->state,
+             t->map_count, (unsigned long long)t->total_vm,
+             (unsigned long long)t->stack_vm, (unsigned long long)t->runtime_ns,
+             (unsigned long long)t->nvcsw, (unsigned long long)t->nivcsw,
+             (unsigned long long)t->io.rchar_rate, (unsigned long long)t->io.wchar_rate,
+             t->flags & PINFO_TICK_NO_MM ? " (no mm)" : "");
+  }
+  if (hdr->flags & PINFO_TRUNCATED)
+     fprintf(stdout, "some samples were dropped\n");
 }
 
+
+/*
+ * A function to print the events of a watches response of len
+ * bytes, checking that the response has the expected layout.
+ */
+
+void print_events(int len)
+{
+  struct pinfo_header *hdr = (struct pinfo_header *)resp_buf;
+  struct pinfo_event *ev;
+  char *pos;
+  int i;
+
+  if (len < sizeof(*hdr) || hdr->magic != PINFO_MAGIC ||
+      !(hdr->flags & PINFO_EVENTS) || hdr->rec_size < sizeof(*ev) ||
+      len < sizeof(*hdr) + (long)hdr->count * hdr->rec_size) {
+     fprintf (stderr, "invalid watches response (%d bytes)\n", len);
+     exit (-1);
+  }
+
+  pos = resp_buf + sizeof(*hdr);
+  for (i = 0; i < hdr->count; i++, pos += hdr->rec_size) {
+     ev = (struct pinfo_event *)pos;
+     if (ev->flags & PINFO_WATCH_GONE)
+        fprintf(stdout, "PID %d can no longer be watched\n", ev->pid);
+     else
+        fprintf(stdout, "PID %d %s %llu went %s %llu at %llu ns\n", ev->pid,
+                ev->field == PINFO_FIELD_TOTAL_VM ? "total_vm" : "map_count",
+                (unsigned long long)ev->value,
+                ev->flags & PINFO_WATCH_ABOVE ? "above" : "to or below",
+                (unsigned long long)ev->threshold, (unsigned long long)ev->time_ns);
+  }
+}
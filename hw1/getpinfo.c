@@ -3,6 +3,7 @@
  * it as a new-line delimited string
  */ 
 #include <linux/module.h>
+#include <linux/version.h>
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/fs.h>
@@ -12,6 +13,37 @@
 #include <linux/slab.h>
 #include <linux/mm_types.h>
 #include <linux/rwsem.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/ctype.h>
+#include <linux/sort.h>
+#include <linux/atomic.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/workqueue.h>
+#include <linux/pid_namespace.h>
+#include <linux/uio.h>
+#include <linux/limits.h>
+#include <linux/delay.h>
+#include <linux/huge_mm.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0)
+#include <linux/pagewalk.h>
+#endif
+#include <linux/math64.h>
+#include <linux/cpu.h>
+#include <linux/kref.h>
+#include <linux/completion.h>
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/pid.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+#include <linux/sched/mm.h>
 
 #include "getpinfo.h" /* used by both kernel module and user program 
                      * to define shared parameters including the
@@ -19,23 +51,2133 @@
                      * a system call
                      */
 
-/* The following two variables are global state shared between
- * the "call" and "return" functions.  They need to be protected
- * from re-entry caused by kernel preemption.
+/* A response is built by appending through a cursor, so each line
+ * costs only its own length.  The buffer belongs to the context and
+ * is kept from call to call, so once it has grown to the size of the
+ * responses asked for, a call allocates no memory.
  */
-/* The call_task variable is used to ensure that the result is
+struct pinfo_buf {
+  char *buf;
+  size_t len;   // bytes used, not counting the string termination
+  size_t size;  // bytes allocated
+  bool fixed;   // the buffer cannot grow (a ring slot)
+};
+
+/* The tasks a call reports on, each with a reference held */
+struct task_set {
+  struct task_struct **tasks;
+  unsigned int nr;
+  unsigned int size;  // entries allocated
+};
+
+/* Which tasks a call reports on */
+enum pinfo_scope {
+  SCOPE_SIBLINGS,  // the caller and up to MAX_SIBLINGS of its siblings
+  SCOPE_TREE,      // a process and all of its descendants
+  SCOPE_ALL,       // every task on the system
+  SCOPE_PIDS,      // the tasks with the pids listed in the call
+};
+
+/* The options given after "getpinfo" in a call string */
+/* A condition of a "where" clause, checked by pred_match() */
+enum pred_field { PRED_PID, PRED_PPID, PRED_STATE, PRED_PRIO, PRED_TOTAL_VM,
+                  PRED_RSS, PRED_MAP_COUNT, PRED_COMM };
+enum pred_op { PRED_EQ, PRED_NE, PRED_LT, PRED_LE, PRED_GT, PRED_GE, PRED_PREFIX };
+
+struct pinfo_pred {
+  u8 field;     // enum pred_field
+  u8 op;        // enum pred_op
+  bool or;      // starts a new "or" term
+  s64 value;
+  char comm[TASK_COMM_LEN];  // for PRED_COMM
+};
+
+struct pinfo_query {
+  bool binary;  // return struct pinfo_record entries instead of text
+  bool ring;    // publish the binary response in the mmap() ring
+  enum pinfo_scope scope;
+  pid_t root;   // SCOPE_TREE root, 0 for the caller
+  unsigned int nr_pids;  // SCOPE_PIDS pids, in the context's pids
+  bool delta;   // return changes since a generation
+  u64 since;    // the generation given, 0 for none
+  bool sample;  // (re)start or stop the sampler
+  unsigned int period_us;  // sampler period, 0 to stop it
+  bool drain;   // return the sampler's buffered samples
+  bool watch;   // put a watch on each task
+  u32 field;    // the watched field, PINFO_FIELD_*
+  u64 threshold;
+  bool watches; // return the watches that fired
+  bool vmas;    // list the VMAs of each task, streamed as text
+  bool wss;     // estimate the working set of each task
+  unsigned int window_ms;  // how long the working set is measured over
+  unsigned int top;  // rank processes by field and return this many, 0 for all
+  bool groups;  // one record per thread group, for its leader
+  bool sched;   // add struct pinfo_sched to the records
+  bool mem;     // add struct pinfo_mem to the records
+  bool io;      // add struct pinfo_io to the records
+  bool parallel; // sample the tasks on all CPUs
+  bool share;   // wait for an identical call in flight
+  unsigned int fresh_ms;  // take a response this recent, 0 for none
+  unsigned int nr_preds;  // conditions tasks must match, 0 for none
+  struct pinfo_pred preds[MAX_PREDS];
+};
+
+/* A process ranked by a "top" call, with the value of the field it was
+ * ranked by.
+ */
+struct top_entry {
+  u64 value;
+  struct task_struct *tsk;
+};
+
+/* The info reported for a task.  The records of a delta call's
+ * response are kept sorted by pid, so the next call can tell which
+ * tasks changed.
+ */
+struct pinfo_sample {
+  struct pinfo_record rec;
+  struct pinfo_sched sched;  // if the call asked for it
+  struct pinfo_mem mem;      // likewise
+  struct pinfo_io io;
+  u64 io_ns;                 // when the I/O counters were read, 0 if not
+  char comm[TASK_COMM_LEN];
+};
+
+struct pinfo_snap {
+  struct pinfo_sample *samples;
+  unsigned int nr;
+  unsigned int size;  // entries allocated
+};
+
+/* The sampler's buffer on one CPU.  Its lock is only contended by a
+ * drain, never by the timer running on another CPU.
+ */
+struct tick_buf {
+  spinlock_t lock;
+  unsigned int nr;       // samples buffered
+  unsigned int dropped;  // samples lost to a full buffer since the last drain
+  struct pinfo_tick *ticks;  // PINFO_TICKS_PER_CPU entries
+};
+
+/* The periodic sampler of an open file.  The timer callback runs in
+ * interrupt context, so it can neither sleep nor take mm locks; it
+ * reads counters that are single words, from tasks and mm_structs
+ * that references taken when sampling started keep from being freed.
+ * The mm reference (mmgrab()) keeps the mm_struct itself, not the
+ * task's memory, so it does not delay the memory being freed.
+ */
+struct pinfo_sampler {
+  struct hrtimer timer;
+  ktime_t period;
+  unsigned int nr;
+  struct task_struct *tasks[MAX_SAMPLED];
+  struct mm_struct *mms[MAX_SAMPLED];  // NULL for no user memory
+  struct pinfo_io last_io[MAX_SAMPLED];  // each task's previous sample, for rates
+  u64 last_ns[MAX_SAMPLED];
+  struct tick_buf __percpu *bufs;
+};
+
+/* A threshold watch on a task, holding references like the sampler's */
+struct pinfo_watch {
+  struct task_struct *tsk;
+  struct mm_struct *mm;
+  struct pinfo_event ev;  // filled in when the watch fires
+  bool fired;
+};
+
+/* The watches of an open file and the timer checking them.  The
+ * watches are only changed with the timer cancelled (under the
+ * context's mutex), so its callback needs no lock; it stops itself
+ * once no watch is left to fire.
+ */
+struct pinfo_watcher {
+  struct hrtimer timer;
+  unsigned int nr;
+  unsigned int nr_fired;  // read by poll() without the mutex
+  struct pinfo_watch watches[MAX_WATCHES];
+  wait_queue_head_t *wait;
+};
+
+/* Each open of the debugfs file gets its own context holding the
+ * state shared between the "call" and "return" functions, so any
+ * number of processes can have calls in flight at the same time.
+ * The context is kept in file->private_data; its mutex protects it
+ * from concurrent use of the same open file (threads, or a process
+ * and its children after fork()).
+ */
+/* The call_task field is used to ensure that the result is
  * returned only to the process that made the call.  Only one
- * result can be pending for return at a time (any call entry 
- * while the variable is non-NULL is rejected).
+ * result can be pending for return at a time on an open file
+ * (any call entry while the field is non-NULL is rejected).
+ * The caller's pid and pid namespace are referenced by the write(),
+ * since a worker running the call may outlive the calling thread.
+ */
+struct pinfo_ctx {
+  struct mutex lock;
+  struct task_struct *call_task;
+  struct pid *call_pid;
+  struct pid_namespace *call_ns;
+  struct pinfo_query query;  // the call being answered
+  struct pinfo_buf resp;     // the response to return
+  struct pinfo_buf *out;     // where the call's response is built
+  struct pinfo_ring *ring;   // snapshots for mmap(), allocated on first use
+  struct task_set set;       // tasks being reported on
+  char *long_call;           // call strings of MAX_CALL or more, allocated on first use
+  pid_t *pids;               // pids listed in the call, allocated on first use
+  struct top_entry *top;     // MAX_TOP ranked processes, allocated on first use
+  struct pinfo_part *parts;  // nr_cpu_ids parts of "parallel" calls, allocated on first use
+  u64 gen;                   // generation of the last delta call's response
+  struct pinfo_snap snap[2]; // the last delta call's records, and the next's
+  struct pinfo_sampler *sampler;  // allocated on first use
+  struct pinfo_watcher *watcher;  // allocated on first use
+  wait_queue_head_t wait;    // poll() waiters, and read() waiting for a call
+  struct work_struct work;   // runs a call made with O_NONBLOCK
+  bool busy;                 // the work is queued or running
+  bool closing;              // set by release() to make the work give up waiting
+  int async_rc;              // error from the work, returned by read()
+  bool more;                 // the response is generated as it is read
+  loff_t win_start;          // file offset of the response buffer's first byte
+  unsigned int vma_task;     // next task of the set to list the VMAs of
+  struct mm_struct *vma_mm;  // mm being listed, NULL between tasks
+  unsigned long vma_next;    // address to continue the listing at
+  char *path;                // PATH_MAX bytes for file names, allocated on first use
+  char *key;                 // a shared call's string, allocated on first use
+};
+
+/* Generations come from one counter so a token is never valid for
+ * another open file.
+ */
+static atomic64_t pinfo_generation = ATOMIC64_INIT(0);
+
+int file_value;
+struct dentry *dir, *file;  // used to set up debugfs file name
+static struct workqueue_struct *getpinfo_wq;  // runs calls made with O_NONBLOCK
+static struct workqueue_struct *getpinfo_pwq; // per-CPU workers of "parallel" calls
+
+/* The response of a call that can be shared, while it is being made
+ * and for PINFO_FRESH_MAX_MS after.  The list of results holds one
+ * reference, and each call using one holds another.
+ */
+struct pinfo_result {
+  struct list_head node;     // in pinfo_results
+  struct kref ref;
+  struct pid_namespace *ns;
+  pid_t caller;              // for calls about the caller's relatives, else 0
+  char *key;
+  struct completion done;    // completed once the response is made
+  bool ready;
+  u64 time_ns;               // when the response was made
+  char *buf;                 // the response and a '\0', NULL if the call failed
+  size_t len;
+};
+
+#define PINFO_MAX_RESULTS 64
+
+static DEFINE_MUTEX(pinfo_results_lock);
+static LIST_HEAD(pinfo_results);  // oldest first
+static unsigned int nr_results;
+static DECLARE_WAIT_QUEUE_HEAD(pinfo_results_wait);  // a result was made, or a file is closing
+
+static u32 gen_range(struct pinfo_ctx *ctx, struct pinfo_buf *pb, unsigned int first,
+                     unsigned int end, bool *truncated);
+static u32 gen_parallel(struct pinfo_ctx *ctx, bool *truncated);
+static void parts_free(struct pinfo_ctx *ctx);
+static int gen_delta(struct pinfo_ctx *ctx);
+static void call_work(struct work_struct *work);
+static void vma_stop(struct pinfo_ctx *ctx);
+
+/* Makes room for at least need more bytes at the cursor, at least
+ * doubling the buffer so appending stays linear overall.
+ */
+static int pinfo_grow(struct pinfo_buf *pb, size_t need)
+{
+  size_t size = max(2 * pb->size, pb->len + need);
+  char *buf;
+
+  if (pb->fixed)
+    return -ENOSPC;
+  buf = kvmalloc(size, GFP_KERNEL);
+  if (buf == NULL)
+    return -ENOMEM;
+  memcpy(buf, pb->buf, pb->len);
+  buf[pb->len] = '\0';
+  kvfree(pb->buf);
+  pb->buf = buf;
+  pb->size = size;
+  return 0;
+}
+
+/* Appends formatted text at the cursor, keeping the buffer a
+ * terminated string; text is truncated only if the buffer cannot grow,
+ * and a buffer with no memory yet is left as it was.
+ */
+static __printf(2, 3) void pinfo_printf(struct pinfo_buf *pb, const char *fmt, ...)
+{
+  va_list args;
+  size_t n;
+
+  va_start(args, fmt);
+  n = vsnprintf(pb->buf + pb->len, pb->size - pb->len, fmt, args);
+  va_end(args);
+  if (pb->len + n >= pb->size) {
+    if (pinfo_grow(pb, n + 1) != 0) {
+      if (pb->size != 0)
+        pb->len = pb->size - 1;  // vsnprintf() kept what fit
+      return;
+    }
+    va_start(args, fmt);
+    vsnprintf(pb->buf + pb->len, pb->size - pb->len, fmt, args);
+    va_end(args);
+  }
+  pb->len += n;
+}
+
+/* Appends binary data at the cursor; it is all or nothing */
+static int pinfo_append(struct pinfo_buf *pb, const void *data, size_t len)
+{
+  if (pb->size - pb->len < len && pinfo_grow(pb, len) != 0)
+    return -ENOSPC;
+  memcpy(pb->buf + pb->len, data, len);
+  pb->len += len;
+  return 0;
+}
+
+static void pinfo_reset(struct pinfo_buf *pb)
+{
+  pb->len = 0;
+  pb->buf[0] = '\0';
+}
+
+/* This function allocates the snapshot ring of a context.  The
+ * memory is zeroed and suitable for mapping into user space.
+ */
+static int ring_alloc(struct pinfo_ctx *ctx)
+{
+  if (ctx->ring != NULL)
+    return 0;
+  ctx->ring = vmalloc_user(PINFO_RING_SIZE);
+  if (ctx->ring == NULL)
+    return -ENOMEM;
+  ctx->ring->magic = PINFO_MAGIC;
+  ctx->ring->nr_slots = PINFO_RING_SLOTS;
+  ctx->ring->slot_size = PINFO_SLOT_SIZE;
+  return 0;
+}
+
+/* These functions bracket building a response directly in the next
+ * slot of the ring.  While it is built the slot's seq is odd, so
+ * readers that raced with the rewrite can tell.
+ */
+static void ring_begin(struct pinfo_ctx *ctx, struct pinfo_buf *slot_buf)
+{
+  u64 n = ctx->ring->head + 1;
+  struct pinfo_slot *slot = PINFO_SLOT(ctx->ring, n);
+
+  WRITE_ONCE(slot->seq, 2 * n - 1);
+  smp_wmb();  // mark the slot before changing its content
+  slot_buf->buf = (char *)(slot + 1);
+  slot_buf->len = 0;
+  slot_buf->size = PINFO_SLOT_SIZE - sizeof(*slot);
+  slot_buf->fixed = true;
+}
+
+static void ring_publish(struct pinfo_ctx *ctx, struct pinfo_buf *slot_buf)
+{
+  u64 n = ctx->ring->head + 1;
+  struct pinfo_slot *slot = PINFO_SLOT(ctx->ring, n);
+
+  slot->len = slot_buf->len;
+  smp_wmb();  // complete the content before marking the slot
+  WRITE_ONCE(slot->seq, 2 * n);
+  smp_store_release(&ctx->ring->head, n);
+}
+
+/* A working-set scan examines at most PINFO_WSS_BATCH page table
+ * entries at a time under mmap_sem, then drops it and pauses for
+ * PINFO_WSS_PAUSE_US; it takes mmap_sem only once it has been free for
+ * one of PINFO_WSS_TRIES tries, one pause apart, before waiting for it.
+ */
+#define PINFO_WSS_MAX_WINDOW_MS 60000
+#define PINFO_WSS_BATCH 4096
+#define PINFO_WSS_PAUSE_US 1000
+#define PINFO_WSS_TRIES 100
+
+static const char *const field_names[] = {
+  [PINFO_FIELD_TOTAL_VM] = "total_vm",
+  [PINFO_FIELD_MAP_COUNT] = "map_count",
+  [PINFO_FIELD_RSS] = "rss",
+};
+
+static const char *const pred_fields[] = {
+  [PRED_PID] = "pid", [PRED_PPID] = "ppid", [PRED_STATE] = "state", [PRED_PRIO] = "prio",
+  [PRED_TOTAL_VM] = "total_vm", [PRED_RSS] = "rss", [PRED_MAP_COUNT] = "map_count",
+  [PRED_COMM] = "comm",
+};
+
+static const char *const pred_ops[] = {
+  [PRED_EQ] = "==", [PRED_NE] = "!=", [PRED_LT] = "<", [PRED_LE] = "<=",
+  [PRED_GT] = ">", [PRED_GE] = ">=", [PRED_PREFIX] = "prefix",
+};
+
+static const struct {
+  const char *name;
+  long state;
+} pred_states[] = {
+  { "running", TASK_RUNNING },
+  { "sleeping", TASK_INTERRUPTIBLE },
+  { "disk", TASK_UNINTERRUPTIBLE },
+  { "stopped", __TASK_STOPPED },
+  { "traced", __TASK_TRACED },
+};
+
+/* This function returns the next token of a "where" clause, skipping
+ * the empty tokens of repeated separators as the call parser does, or
+ * NULL at the end of the call.
+ */
+static char *where_token(char **cur)
+{
+  char *tok;
+
+  do
+    tok = strsep(cur, " \n");
+  while (tok != NULL && *tok == '\0');
+  return tok;
+}
+
+/* This function parses the conditions of a "where" clause into the
+ * query, checking that each names a known field and an operator that
+ * applies to it, so that matching a task cannot fail.
+ */
+static int parse_where(struct pinfo_query *q, char **cur)
+{
+  struct pinfo_pred *p;
+  char *field, *op, *value;
+  bool or = false;
+  unsigned int i;
+
+  for (;;) {
+    field = where_token(cur);
+    op = where_token(cur);
+    value = where_token(cur);
+    if (value == NULL || q->nr_preds == MAX_PREDS)
+      return -EINVAL;
+    p = &q->preds[q->nr_preds++];
+    p->or = or;
+    for (i = 0; i < ARRAY_SIZE(pred_fields) && strcmp(field, pred_fields[i]) != 0; i++)
+      ;
+    if (i == ARRAY_SIZE(pred_fields))
+      return -EINVAL;
+    p->field = i;
+    for (i = 0; i < ARRAY_SIZE(pred_ops) && strcmp(op, pred_ops[i]) != 0; i++)
+      ;
+    if (i == ARRAY_SIZE(pred_ops))
+      return -EINVAL;
+    p->op = i;
+
+    if (p->field == PRED_COMM) {
+      if ((p->op != PRED_EQ && p->op != PRED_NE && p->op != PRED_PREFIX) ||
+          strscpy(p->comm, value, sizeof(p->comm)) < 0)
+        return -EINVAL;
+    }
+    else if (p->op == PRED_PREFIX)
+      return -EINVAL;
+    else if (p->field == PRED_STATE && !isdigit(*value)) {
+      for (i = 0; i < ARRAY_SIZE(pred_states) && strcmp(value, pred_states[i].name) != 0; i++)
+        ;
+      if (i == ARRAY_SIZE(pred_states))
+        return -EINVAL;
+      p->value = pred_states[i].state;
+    }
+    else if (kstrtos64(value, 0, &p->value) != 0)
+      return -EINVAL;
+
+    if (*cur == NULL)
+      return 0;
+    *cur = skip_spaces(*cur);  // separators before the next token
+    if (strncmp(*cur, "and", 3) == 0 && isspace((*cur)[3]))
+      or = false;
+    else if (strncmp(*cur, "or", 2) == 0 && isspace((*cur)[2]))
+      or = true;
+    else
+      return 0;  // the clause ends here
+    where_token(cur);
+  }
+}
+
+/* This function makes the key a shared call is known by from its
+ * parsed query, so that calls asking for the same response share it
+ * whatever the order of their options.  What does not change the
+ * response (the sharing options and "parallel") is left out.  Listed
+ * pids and "where" conditions keep their order, which the response
+ * and the conditions' meaning follow.  A "top" call ranks every
+ * process unless it is given a tree, so it is keyed as "all" then.
+ * The key has room for the most pids and conditions a call can have.
+ */
+#define PINFO_KEY_SIZE (64 + MAX_PIDS * 12 + MAX_PREDS * (TASK_COMM_LEN + 32))
+
+static int make_key(struct pinfo_ctx *ctx)
+{
+  struct pinfo_query *q = &ctx->query;
+  enum pinfo_scope scope = q->scope;
+  struct pinfo_pred *p;
+  char *key;
+  size_t n;
+  unsigned int i;
+
+  if (ctx->key == NULL)
+    ctx->key = kvmalloc(PINFO_KEY_SIZE, GFP_KERNEL);
+  if (ctx->key == NULL)
+    return -ENOMEM;
+  key = ctx->key;
+  if (q->top != 0 && scope != SCOPE_TREE)
+    scope = SCOPE_ALL;
+  n = scnprintf(key, PINFO_KEY_SIZE, "b%d g%d s%d m%d i%d scope %d root %d top %u field %u",
+                q->binary, q->groups, q->sched, q->mem, q->io, scope,
+                scope == SCOPE_TREE ? q->root : 0, q->top, q->top != 0 ? q->field : 0);
+  if (scope == SCOPE_PIDS)
+    for (i = 0; i < q->nr_pids; i++)
+      n += scnprintf(key + n, PINFO_KEY_SIZE - n, " %d", ctx->pids[i]);
+  for (i = 0; i < q->nr_preds; i++) {
+    p = &q->preds[i];
+    n += scnprintf(key + n, PINFO_KEY_SIZE - n, " %s %u %u %lld %s", p->or ? "or" : "and",
+                   p->field, p->op, p->value, p->field == PRED_COMM ? p->comm : "");
+  }
+  return 0;
+}
+
+/* This function parses a call string of the form
+ *   getpinfo [binary] [ring] [all | tree [<pid>] | pids <pid>...]
+ *            [since <generation>] [sample <period_us>]
+ *            [watch <total_vm | map_count> <threshold>] [vmas]
+ *            [wss <window_ms>] [top <n> <total_vm | rss | map_count>]
+ *            [groups] [sched] [mem] [io] [parallel] [share] [fresh <ms>]
+ *            [where <condition>...]
+ *   getpinfo [ring] drain | watches
+ * into the context's query.  The string is split up in place, and for
+ * a call that can be shared the query is then made into the context's key.
+ */
+static int parse_call(struct pinfo_ctx *ctx, char *call)
+{
+  struct pinfo_query *q = &ctx->query;
+  char *cur = call;
+  char *tok;
+
+  memset(q, 0, sizeof(*q));
+  tok = strsep(&cur, " \n");
+  if (strcmp(tok, "getpinfo") != 0) // only valid call is "getpinfo"
+    return -EINVAL;
+  while ((tok = strsep(&cur, " \n")) != NULL) {
+    if (*tok == '\0')
+      continue;  // repeated separators
+    if (strcmp(tok, "binary") == 0)
+      q->binary = true;
+    else if (strcmp(tok, "ring") == 0)
+      q->binary = q->ring = true;  // the ring holds binary responses
+    else if (strcmp(tok, "all") == 0)
+      q->scope = SCOPE_ALL;
+    else if (strcmp(tok, "tree") == 0) {
+      q->scope = SCOPE_TREE;
+      if (cur != NULL && isdigit(*cur)) {  // an optional root pid
+        tok = strsep(&cur, " \n");
+        if (kstrtoint(tok, 10, &q->root) != 0)
+          return -EINVAL;
+      }
+    }
+    else if (strcmp(tok, "pids") == 0) {
+      q->scope = SCOPE_PIDS;
+      if (ctx->pids == NULL)
+        ctx->pids = kvmalloc_array(MAX_PIDS, sizeof(pid_t), GFP_KERNEL);
+      if (ctx->pids == NULL)
+        return -ENOMEM;
+      while (cur != NULL && isdigit(*(cur = skip_spaces(cur)))) {
+        tok = strsep(&cur, " \n");
+        if (q->nr_pids == MAX_PIDS || kstrtoint(tok, 10, &ctx->pids[q->nr_pids]) != 0)
+          return -EINVAL;
+        q->nr_pids++;
+      }
+    }
+    else if (strcmp(tok, "sample") == 0) {
+      q->sample = true;
+      tok = strsep(&cur, " \n");
+      if (tok == NULL || kstrtouint(tok, 10, &q->period_us) != 0)
+        return -EINVAL;
+      if (q->period_us != 0 && q->period_us < PINFO_MIN_PERIOD_US)
+        return -EINVAL;
+    }
+    else if (strcmp(tok, "drain") == 0)
+      q->drain = q->binary = true;  // samples are only returned as records
+    else if (strcmp(tok, "watch") == 0) {
+      q->watch = true;
+      tok = strsep(&cur, " \n");
+      if (tok != NULL && strcmp(tok, "total_vm") == 0)
+        q->field = PINFO_FIELD_TOTAL_VM;
+      else if (tok != NULL && strcmp(tok, "map_count") == 0)
+        q->field = PINFO_FIELD_MAP_COUNT;
+      else
+        return -EINVAL;
+      tok = strsep(&cur, " \n");
+      if (tok == NULL || kstrtou64(tok, 10, &q->threshold) != 0)
+        return -EINVAL;
+    }
+    else if (strcmp(tok, "watches") == 0)
+      q->watches = q->binary = true;  // events are only returned as records
+    else if (strcmp(tok, "vmas") == 0)
+      q->vmas = true;
+    else if (strcmp(tok, "groups") == 0)
+      q->groups = true;
+    else if (strcmp(tok, "sched") == 0)
+      q->sched = true;
+    else if (strcmp(tok, "mem") == 0)
+      q->mem = true;
+    else if (strcmp(tok, "io") == 0)
+      q->io = true;
+    else if (strcmp(tok, "parallel") == 0)
+      q->parallel = true;
+    else if (strcmp(tok, "share") == 0)
+      q->share = true;
+    else if (strcmp(tok, "fresh") == 0) {
+      tok = strsep(&cur, " \n");
+      if (tok == NULL || kstrtouint(tok, 10, &q->fresh_ms) != 0 ||
+          q->fresh_ms == 0 || q->fresh_ms > PINFO_FRESH_MAX_MS)
+        return -EINVAL;
+    }
+    else if (strcmp(tok, "where") == 0) {
+      if (parse_where(q, &cur) != 0)
+        return -EINVAL;
+    }
+    else if (strcmp(tok, "wss") == 0) {
+      q->wss = true;
+      tok = strsep(&cur, " \n");
+      if (tok == NULL || kstrtouint(tok, 10, &q->window_ms) != 0 ||
+          q->window_ms == 0 || q->window_ms > PINFO_WSS_MAX_WINDOW_MS)
+        return -EINVAL;
+    }
+    else if (strcmp(tok, "top") == 0) {
+      tok = strsep(&cur, " \n");
+      if (tok == NULL || kstrtouint(tok, 10, &q->top) != 0 ||
+          q->top == 0 || q->top > MAX_TOP)
+        return -EINVAL;
+      tok = strsep(&cur, " \n");
+      if (tok != NULL && strcmp(tok, "total_vm") == 0)
+        q->field = PINFO_FIELD_TOTAL_VM;
+      else if (tok != NULL && strcmp(tok, "rss") == 0)
+        q->field = PINFO_FIELD_RSS;
+      else if (tok != NULL && strcmp(tok, "map_count") == 0)
+        q->field = PINFO_FIELD_MAP_COUNT;
+      else
+        return -EINVAL;
+    }
+    else if (strcmp(tok, "since") == 0) {
+      q->delta = true;
+      tok = strsep(&cur, " \n");
+      if (tok == NULL || kstrtou64(tok, 10, &q->since) != 0)
+        return -EINVAL;
+    }
+    else
+      return -EINVAL;
+  }
+  if ((q->vmas || q->wss) && q->binary)  // these are only reported as text
+    return -EINVAL;
+  if (q->top != 0 && (q->watch || q->scope == SCOPE_PIDS))  // field is the ranking's
+    return -EINVAL;
+  if (q->share || q->fresh_ms != 0) {
+    if (q->ring || q->delta || q->sample || q->drain || q->watch || q->watches ||
+        q->vmas || q->wss)  // these depend on the open file's state
+      return -EINVAL;
+    return make_key(ctx);
+  }
+  return 0;
+}
+
+/* This function makes the task set hold at least size entries.
+ * References in it have been dropped by the caller.
+ */
+static int task_set_grow(struct task_set *set, unsigned int size)
+{
+  struct task_struct **tasks;
+
+  if (size <= set->size)
+    return 0;
+  tasks = kvmalloc_array(size, sizeof(*tasks), GFP_KERNEL);
+  if (tasks == NULL)
+    return -ENOMEM;
+  kvfree(set->tasks);
+  set->tasks = tasks;
+  set->size = size;
+  return 0;
+}
+
+static void task_set_put(struct task_set *set)
+{
+  unsigned int i;
+
+  for (i = 0; i < set->nr; i++)
+    if (set->tasks[i] != NULL)
+      put_task_struct(set->tasks[i]);
+  set->nr = 0;
+}
+
+/* This function tells whether a task is root or descends from it.
+ * Threads have the parent of their thread group leader.  The caller
+ * holds rcu_read_lock().
+ */
+static bool in_tree(struct task_struct *tsk, struct task_struct *root)
+{
+  while (tsk != &init_task) {
+    if (same_thread_group(tsk, root))
+      return true;
+    tsk = rcu_dereference(tsk->real_parent);
+  }
+  return root == &init_task;
+}
+
+/* This function reads the field a "top" call ranks by.  The task lock
+ * keeps the task's mm from being dropped while it is read, and can be
+ * taken under rcu_read_lock().  Tasks with no mm are not ranked.
+ */
+static bool top_value(struct task_struct *tsk, u32 field, u64 *value)
+{
+  struct mm_struct *mm;
+
+  task_lock(tsk);
+  mm = tsk->mm;
+  if (mm != NULL) {
+    if (field == PINFO_FIELD_TOTAL_VM)
+      *value = READ_ONCE(mm->total_vm);
+    else if (field == PINFO_FIELD_RSS)
+      *value = get_mm_rss(mm);
+    else
+      *value = READ_ONCE(mm->map_count);
+  }
+  task_unlock(tsk);
+  return mm != NULL;
+}
+
+static bool pred_cmp(s64 a, u8 op, s64 b)
+{
+  switch (op) {
+  case PRED_EQ: return a == b;
+  case PRED_NE: return a != b;
+  case PRED_LT: return a < b;
+  case PRED_LE: return a <= b;
+  case PRED_GT: return a > b;
+  default: return a >= b;
+  }
+}
+
+/* This function checks one condition of a "where" clause.  A memory
+ * condition does not hold for a task with no mm.
+ */
+static bool pred_eval(const struct pinfo_pred *p, struct task_struct *tsk)
+{
+  char comm[TASK_COMM_LEN];
+  u64 value;
+  s64 v;
+
+  switch (p->field) {
+  case PRED_PID:
+    v = task_pid_nr(tsk);
+    break;
+  case PRED_PPID:
+    v = task_pid_nr(rcu_dereference(tsk->real_parent));
+    break;
+  case PRED_STATE:
+    v = READ_ONCE(tsk->state);
+    break;
+  case PRED_PRIO:
+    v = READ_ONCE(tsk->normal_prio);
+    break;
+  case PRED_COMM:
+    get_task_comm(comm, tsk);
+    if (p->op == PRED_PREFIX)
+      return strncmp(comm, p->comm, strlen(p->comm)) == 0;
+    return (strcmp(comm, p->comm) == 0) == (p->op == PRED_EQ);
+  default:
+    if (!top_value(tsk, p->field == PRED_TOTAL_VM ? PINFO_FIELD_TOTAL_VM :
+                   p->field == PRED_RSS ? PINFO_FIELD_RSS : PINFO_FIELD_MAP_COUNT, &value))
+      return false;
+    v = value;
+    break;
+  }
+  return pred_cmp(v, p->op, p->value);
+}
+
+/* This function tells whether a task matches a call's "where" clause,
+ * an "or" of terms that are each an "and" of conditions.  Nothing in
+ * it sleeps, so it is run during the walks of the task list, under
+ * rcu_read_lock().
+ */
+static bool pred_match(const struct pinfo_query *q, struct task_struct *tsk)
+{
+  bool term = true;
+  unsigned int i;
+
+  for (i = 0; i < q->nr_preds; i++) {
+    if (q->preds[i].or) {
+      if (term)
+        return true;
+      term = true;
+    }
+    if (term && !pred_eval(&q->preds[i], tsk))
+      term = false;
+  }
+  return term;
+}
+
+/* This function tells whether one of the first nr entries of a task
+ * set is tsk.
+ */
+static bool task_set_has(const struct task_set *set, unsigned int nr,
+                         const struct task_struct *tsk)
+{
+  unsigned int i;
+
+  for (i = 0; i < nr; i++)
+    if (set->tasks[i] == tsk)
+      return true;
+  return false;
+}
+
+/* This function ends the call on a context, so its response is
+ * taken and another call can be made, dropping the references the
+ * write() took.
+ */
+static void call_end(struct pinfo_ctx *ctx)
+{
+  ctx->call_task = NULL;
+  if (ctx->call_pid != NULL)
+    put_pid(ctx->call_pid);
+  ctx->call_pid = NULL;
+  if (ctx->call_ns != NULL)
+    put_pid_ns(ctx->call_ns);
+  ctx->call_ns = NULL;
+}
+
+/* This function collects references to the tasks a call reports on.
+ *
+ * The task list is walked under rcu_read_lock(), which protects it
+ * from tasks exiting during the walk.  Siblings are found on their
+ * parent's children list instead, so the walk is no longer than the
+ * family; that list is only protected by tasklist_lock, which modules
+ * cannot take, so the walk stops at the first task it finds unlinked
+ * or moved to another parent (task_structs themselves are freed only
+ * after RCU readers are done).  Nothing in the walk can sleep, so
+ * references are put in an array allocated beforehand; if more tasks
+ * matched than fit, the walk is redone with a larger array.  All
+ * per-task work is done after the walk, with preemption enabled.
+ *
+ * Listed pids are looked up the same way, in the order given, in the
+ * caller's pid namespace.  A pid with no task gets a NULL entry so it
+ * can be reported as missing, and so does init, which is never
+ * sampled.  With "groups", only thread group leaders are collected, a
+ * listed pid stands for its leader, and pids of a group already listed
+ * are left out.
+ * Tasks that do not match the call's "where" clause are left out,
+ * along with their listed pids; the set is made to hold all the pids
+ * beforehand so the walk is not redone once they have moved.  The caller is the call's task, not the
+ * current one, which is a worker for calls made with O_NONBLOCK; it is
+ * looked up from its pid, and the call fails with -ESRCH if it exited.
+ */
+static int collect_tasks(struct pinfo_ctx *ctx)
+{
+  struct pinfo_query *q = &ctx->query;
+  struct task_set *set = &ctx->set;
+  struct pid_namespace *ns = ctx->call_ns;
+  struct task_struct *me, *g, *t, *root, *parent;
+  struct list_head *node;
+  unsigned int matched, i;
+
+#define COLLECT(tsk) do {                      \
+    if ((tsk) == NULL || pred_match(q, tsk)) { \
+      if (matched < set->size) {               \
+        if ((tsk) != NULL)                     \
+          get_task_struct(tsk);                \
+        set->tasks[matched] = (tsk);           \
+      }                                        \
+      matched++;                               \
+    }                                          \
+  } while (0)
+
+  if (q->scope == SCOPE_PIDS && task_set_grow(set, q->nr_pids) != 0)
+    return -ENOMEM;
+  for (;;) {
+    matched = 0;
+    rcu_read_lock();
+    me = pid_task(ctx->call_pid, PIDTYPE_PID);
+    if (me == NULL && (q->scope == SCOPE_SIBLINGS || (q->scope == SCOPE_TREE && q->root == 0))) {
+      rcu_read_unlock();
+      return -ESRCH;
+    }
+    switch (q->scope) {
+    case SCOPE_SIBLINGS:
+      // the caller, then other children of its parent in the order
+      // they were created (only thread group leaders are on the list)
+      COLLECT(q->groups ? me->group_leader : me);
+      parent = rcu_dereference(me->real_parent);
+      for (node = READ_ONCE(parent->children.next);
+           node != &parent->children && matched <= MAX_SIBLINGS;
+           node = READ_ONCE(g->sibling.next)) {
+        g = list_entry(node, struct task_struct, sibling);
+        if (READ_ONCE(g->sibling.next) == &g->sibling ||
+            rcu_access_pointer(g->real_parent) != parent)
+          break;  // the list changed under the walk
+        if (g != me->group_leader)
+          COLLECT(g);
+      }
+      break;
+    case SCOPE_TREE:
+      root = q->root ? pid_task(find_pid_ns(q->root, ns), PIDTYPE_PID) : me;
+      if (root == NULL) {
+        rcu_read_unlock();
+        return -ESRCH;
+      }
+      if (q->groups) {
+        for_each_process(g) {
+          if (in_tree(g, root))
+            COLLECT(g);
+        }
+        break;
+      }
+      for_each_process_thread(g, t) {
+        if (in_tree(t, root))
+          COLLECT(t);
+      }
+      break;
+    case SCOPE_ALL:
+      if (q->groups) {
+        for_each_process(g)
+          COLLECT(g);
+        break;
+      }
+      for_each_process_thread(g, t)
+        COLLECT(t);
+      break;
+    case SCOPE_PIDS:
+      for (i = 0; i < q->nr_pids; i++) {
+        unsigned int before = matched;
+
+        t = pid_task(find_pid_ns(ctx->pids[i], ns), PIDTYPE_PID);
+        if (t != NULL && q->groups)
+          t = t->group_leader;
+        if (t != NULL && task_pid_nr(t) == 1)
+          t = NULL;  // sample_task() makes no record for init
+        if (t != NULL && q->groups && task_set_has(set, matched, t))
+          continue;  // another thread of a group already listed
+        COLLECT(t);
+        if (matched > before)  // keep the pids in line with the set
+          ctx->pids[before] = ctx->pids[i];
+      }
+      break;
+    }
+    rcu_read_unlock();
+
+    if (matched <= set->size) {
+      set->nr = matched;
+      return 0;
+    }
+    set->nr = set->size;  // all entries hold references
+    task_set_put(set);
+    if (task_set_grow(set, matched + matched / 8 + 16) != 0)
+      return -ENOMEM;
+  }
+#undef COLLECT
+}
+
+/* This function restores the order of a min-heap of ranked processes
+ * whose entry i may be larger than its children.
+ */
+static void top_sift_down(struct top_entry *heap, unsigned int nr, unsigned int i)
+{
+  unsigned int child;
+
+  while ((child = 2 * i + 1) < nr) {
+    if (child + 1 < nr && heap[child + 1].value < heap[child].value)
+      child++;
+    if (heap[i].value <= heap[child].value)
+      break;
+    swap(heap[i], heap[child]);
+    i = child;
+  }
+}
+
+static void top_sift_up(struct top_entry *heap, unsigned int i)
+{
+  while (i > 0 && heap[i].value < heap[(i - 1) / 2].value) {
+    swap(heap[i], heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+}
+
+/* This function collects references to the processes a "top" call
+ * returns, largest first, with their values in the context's top.
+ *
+ * One walk of the task list under rcu_read_lock() keeps the n largest
+ * processes seen so far in a min-heap, whose root is the one the next
+ * larger process replaces.  Tasks in the heap stay valid until the
+ * walk ends, so references are only taken on the n that remain.  The
+ * heap is then sorted in place, with preemption enabled.  Kernel
+ * threads and init (pid 1) are not ranked, since no record is made
+ * for them.
+ */
+static int collect_top(struct pinfo_ctx *ctx)
+{
+  struct pinfo_query *q = &ctx->query;
+  struct task_set *set = &ctx->set;
+  struct top_entry *heap;
+  struct task_struct *g, *root = NULL;
+  unsigned int nr = 0, i;
+  u64 value;
+
+  if (ctx->top == NULL)
+    ctx->top = kvmalloc_array(MAX_TOP, sizeof(*ctx->top), GFP_KERNEL);
+  if (ctx->top == NULL || task_set_grow(set, q->top) != 0)
+    return -ENOMEM;
+  heap = ctx->top;
+
+  rcu_read_lock();
+  if (q->scope == SCOPE_TREE) {
+    root = pid_task(q->root ? find_pid_ns(q->root, ctx->call_ns) : ctx->call_pid, PIDTYPE_PID);
+    if (root == NULL) {
+      rcu_read_unlock();
+      return -ESRCH;
+    }
+  }
+  for_each_process(g) {  // the mm is shared by the thread group
+    if ((g->flags & PF_KTHREAD) || task_pid_nr(g) == 1 ||
+        (root != NULL && !in_tree(g, root)) || !pred_match(q, g))
+      continue;
+    if (!top_value(g, q->field, &value))
+      continue;
+    if (nr < q->top) {
+      heap[nr].value = value;
+      heap[nr].tsk = g;
+      top_sift_up(heap, nr++);
+    }
+    else if (value > heap[0].value) {
+      heap[0].value = value;
+      heap[0].tsk = g;
+      top_sift_down(heap, nr, 0);
+    }
+  }
+  for (i = 0; i < nr; i++)
+    get_task_struct(heap[i].tsk);
+  rcu_read_unlock();
+
+  // moving each smallest to the end leaves the largest first
+  for (i = nr; i > 1; i--) {
+    swap(heap[0], heap[i - 1]);
+    top_sift_down(heap, i - 1, 0);
+    cond_resched();
+  }
+  for (i = 0; i < nr; i++)
+    set->tasks[i] = heap[i].tsk;
+  set->nr = nr;
+  return 0;
+}
+
+/* This function adds a task's I/O accounting to a record's.  The
+ * counters are plain words, read as they are.
+ */
+static void io_add(struct pinfo_io *io, const struct task_io_accounting *ac)
+{
+#ifdef CONFIG_TASK_XACCT
+  io->rchar += READ_ONCE(ac->rchar);
+  io->wchar += READ_ONCE(ac->wchar);
+  io->syscr += READ_ONCE(ac->syscr);
+  io->syscw += READ_ONCE(ac->syscw);
+#endif
+#ifdef CONFIG_TASK_IO_ACCOUNTING
+  io->read_bytes += READ_ONCE(ac->read_bytes);
+  io->write_bytes += READ_ONCE(ac->write_bytes);
+  io->cancelled_write_bytes += READ_ONCE(ac->cancelled_write_bytes);
+#endif
+}
+
+static u64 io_rate(u64 now, u64 prev, u64 ns)
+{
+  u64 bytes = now - prev;
+
+  if (now <= prev)  // the counters of a thread group can drop as threads exit
+    return 0;
+  if (bytes > U64_MAX / NSEC_PER_SEC)  // too many to scale before dividing
+    return div64_u64(bytes, ns) * NSEC_PER_SEC;
+  return div64_u64(bytes * NSEC_PER_SEC, ns);
+}
+
+/* This function fills in the rates of I/O counters read at now_ns
+ * from those read at prev_ns, if any.
+ */
+static void io_rates(struct pinfo_io *io, const struct pinfo_io *prev, u64 prev_ns, u64 now_ns)
+{
+  u64 ns = now_ns - prev_ns;
+
+  if (prev_ns == 0 || now_ns <= prev_ns)
+    return;
+  io->interval_ns = ns;
+  io->rchar_rate = io_rate(io->rchar, prev->rchar, ns);
+  io->wchar_rate = io_rate(io->wchar, prev->wchar, ns);
+  io->read_rate = io_rate(io->read_bytes, prev->read_bytes, ns);
+  io->write_rate = io_rate(io->write_bytes, prev->write_bytes, ns);
+}
+
+/* This function is the sampler's timer callback.  It appends a sample
+ * of each task to the buffer of the CPU it runs on.
+ */
+static enum hrtimer_restart sampler_tick(struct hrtimer *timer)
+{
+  struct pinfo_sampler *smp = container_of(timer, struct pinfo_sampler, timer);
+  struct tick_buf *tb = this_cpu_ptr(smp->bufs);
+  struct task_struct *tsk;
+  struct mm_struct *mm;
+  struct pinfo_tick *t;
+  u64 now = ktime_get_ns();
+  unsigned int i;
+
+  spin_lock(&tb->lock);
+  for (i = 0; i < smp->nr; i++) {
+    tsk = smp->tasks[i];
+    if (READ_ONCE(tsk->exit_state))  // it has exited, nothing changes any more
+      continue;
+    if (tb->nr == PINFO_TICKS_PER_CPU) {
+      tb->dropped++;
+      continue;
+    }
+    t = &tb->ticks[tb->nr++];
+    memset(t, 0, sizeof(*t));
+    t->time_ns = now;
+    t->pid = task_pid_nr(tsk);
+    t->cpu = smp_processor_id();
+    t->state = READ_ONCE(tsk->state);
+    t->runtime_ns = READ_ONCE(tsk->se.sum_exec_runtime);
+    t->nvcsw = READ_ONCE(tsk->nvcsw);
+    t->nivcsw = READ_ONCE(tsk->nivcsw);
+    io_add(&t->io, &tsk->ioac);
+    io_rates(&t->io, &smp->last_io[i], smp->last_ns[i], now);
+    smp->last_io[i] = t->io;
+    smp->last_ns[i] = now;
+    mm = smp->mms[i];
+    if (mm == NULL)
+      continue;
+    if (READ_ONCE(tsk->mm) != mm) {
+      t->flags |= PINFO_TICK_NO_MM;
+      continue;
+    }
+    t->map_count = READ_ONCE(mm->map_count);
+    t->total_vm = READ_ONCE(mm->total_vm);
+    t->shared_vm = READ_ONCE(mm->shared_vm);
+    t->exec_vm = READ_ONCE(mm->exec_vm);
+    t->stack_vm = READ_ONCE(mm->stack_vm);
+  }
+  spin_unlock(&tb->lock);
+
+  hrtimer_forward_now(timer, smp->period);
+  return HRTIMER_RESTART;
+}
+
+/* This function stops the sampler and drops its references; samples
+ * already buffered are kept for a drain.
+ */
+static void sampler_stop(struct pinfo_sampler *smp)
+{
+  unsigned int i;
+
+  hrtimer_cancel(&smp->timer);  // waits for a callback running
+  for (i = 0; i < smp->nr; i++) {
+    put_task_struct(smp->tasks[i]);
+    if (smp->mms[i] != NULL)
+      mmdrop(smp->mms[i]);
+  }
+  smp->nr = 0;
+}
+
+static void sampler_free(struct pinfo_sampler *smp)
+{
+  int cpu;
+
+  sampler_stop(smp);
+  if (smp->bufs != NULL) {
+    for_each_possible_cpu(cpu)
+      kvfree(per_cpu_ptr(smp->bufs, cpu)->ticks);
+    free_percpu(smp->bufs);
+  }
+  kfree(smp);
+}
+
+static struct pinfo_sampler *sampler_alloc(void)
+{
+  struct pinfo_sampler *smp;
+  struct tick_buf *tb;
+  int cpu;
+
+  smp = kzalloc(sizeof(*smp), GFP_KERNEL);
+  if (smp == NULL)
+    return NULL;
+  hrtimer_init(&smp->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  smp->timer.function = sampler_tick;
+  smp->bufs = alloc_percpu(struct tick_buf);
+  if (smp->bufs == NULL) {
+    kfree(smp);
+    return NULL;
+  }
+  for_each_possible_cpu(cpu) {
+    tb = per_cpu_ptr(smp->bufs, cpu);
+    spin_lock_init(&tb->lock);
+    tb->ticks = kvmalloc_array(PINFO_TICKS_PER_CPU, sizeof(*tb->ticks), GFP_KERNEL);
+    if (tb->ticks == NULL) {
+      sampler_free(smp);
+      return NULL;
+    }
+  }
+  return smp;
+}
+
+/* This function (re)starts the sampler on the tasks collected for the
+ * call, taking over their references, or stops it for a period of 0.
+ */
+static int sampler_arm(struct pinfo_ctx *ctx)
+{
+  struct task_set *set = &ctx->set;
+  struct pinfo_sampler *smp;
+  struct mm_struct *mm;
+  unsigned int i, nr = 0;
+
+  for (i = 0; i < set->nr; i++)
+    if (set->tasks[i] != NULL)
+      nr++;
+  if (nr > MAX_SAMPLED)
+    return -E2BIG;
+  if (ctx->sampler == NULL) {
+    ctx->sampler = sampler_alloc();
+    if (ctx->sampler == NULL)
+      return -ENOMEM;
+  }
+  smp = ctx->sampler;
+  sampler_stop(smp);
+  if (ctx->query.period_us == 0)
+    return 0;
+
+  for (i = 0; i < set->nr; i++) {
+    if (set->tasks[i] == NULL)
+      continue;
+    mm = get_task_mm(set->tasks[i]);
+    if (mm != NULL) {
+      mmgrab(mm);  // keep the mm_struct only
+      mmput(mm);
+    }
+    smp->tasks[smp->nr] = set->tasks[i];
+    smp->last_ns[smp->nr] = 0;  // no rates in the first sample
+    smp->mms[smp->nr++] = mm;
+  }
+  set->nr = 0;  // the references are the sampler's now
+  smp->period = ns_to_ktime((u64)ctx->query.period_us * NSEC_PER_USEC);
+  hrtimer_start(&smp->timer, smp->period, HRTIMER_MODE_REL);
+  return 0;
+}
+
+/* This function reads a watched field, returning false if the task
+ * can no longer be watched.  It runs in the watch timer's callback.
+ */
+static bool watch_read(struct pinfo_watch *w, u64 *value)
+{
+  if (READ_ONCE(w->tsk->exit_state) || w->mm == NULL || READ_ONCE(w->tsk->mm) != w->mm)
+    return false;
+  if (w->ev.field == PINFO_FIELD_TOTAL_VM)
+    *value = READ_ONCE(w->mm->total_vm);
+  else
+    *value = READ_ONCE(w->mm->map_count);
+  return true;
+}
+
+/* This function is the watch timer's callback.  It fires the watches
+ * whose field has crossed the threshold and wakes up poll() waiters.
+ */
+static enum hrtimer_restart watch_tick(struct hrtimer *timer)
+{
+  struct pinfo_watcher *wr = container_of(timer, struct pinfo_watcher, timer);
+  struct pinfo_watch *w;
+  unsigned int i, fired = 0;
+  u64 value = 0;
+
+  for (i = 0; i < wr->nr; i++) {
+    w = &wr->watches[i];
+    if (w->fired)
+      continue;
+    if (!watch_read(w, &value))
+      w->ev.flags |= PINFO_WATCH_GONE;
+    else if ((w->ev.flags & PINFO_WATCH_ABOVE) ? value <= w->ev.threshold : value > w->ev.threshold)
+      continue;  // still on the side it started on
+    w->ev.value = value;
+    w->ev.time_ns = ktime_get_ns();
+    w->fired = true;
+    fired++;
+  }
+  if (fired != 0) {
+    WRITE_ONCE(wr->nr_fired, wr->nr_fired + fired);
+    wake_up_interruptible_poll(wr->wait, EPOLLPRI);
+  }
+  if (wr->nr_fired == wr->nr)
+    return HRTIMER_NORESTART;
+  hrtimer_forward_now(timer, ms_to_ktime(PINFO_WATCH_PERIOD_MS));
+  return HRTIMER_RESTART;
+}
+
+static void watch_pause(struct pinfo_watcher *wr)
+{
+  hrtimer_cancel(&wr->timer);  // a no-op if the timer stopped itself
+}
+
+static void watch_resume(struct pinfo_watcher *wr)
+{
+  if (wr->nr_fired == wr->nr)
+    return;  // nothing left to check
+  hrtimer_start(&wr->timer, ms_to_ktime(PINFO_WATCH_PERIOD_MS), HRTIMER_MODE_REL);
+}
+
+static void watch_put(struct pinfo_watch *w)
+{
+  put_task_struct(w->tsk);
+  if (w->mm != NULL)
+    mmdrop(w->mm);
+}
+
+static void watcher_free(struct pinfo_watcher *wr)
+{
+  unsigned int i;
+
+  watch_pause(wr);
+  for (i = 0; i < wr->nr; i++)
+    watch_put(&wr->watches[i]);
+  kfree(wr);
+}
+
+/* This function puts a watch on each task collected for the call,
+ * taking over their references.  Each watch fires when its field
+ * moves to the other side of the threshold from where it is now.
+ */
+static int watch_add(struct pinfo_ctx *ctx)
+{
+  struct task_set *set = &ctx->set;
+  struct pinfo_watcher *wr;
+  struct pinfo_watch *w;
+  struct mm_struct *mm;
+  unsigned int i, nr = 0;
+  u64 value;
+
+  if (ctx->watcher == NULL) {
+    ctx->watcher = kzalloc(sizeof(*ctx->watcher), GFP_KERNEL);
+    if (ctx->watcher == NULL)
+      return -ENOMEM;
+    hrtimer_init(&ctx->watcher->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    ctx->watcher->timer.function = watch_tick;
+    ctx->watcher->wait = &ctx->wait;
+  }
+  wr = ctx->watcher;
+  for (i = 0; i < set->nr; i++)
+    if (set->tasks[i] != NULL)
+      nr++;
+  if (wr->nr + nr > MAX_WATCHES)
+    return -E2BIG;
+
+  watch_pause(wr);
+  for (i = 0; i < set->nr; i++) {
+    if (set->tasks[i] == NULL)
+      continue;
+    w = &wr->watches[wr->nr++];
+    memset(w, 0, sizeof(*w));
+    w->tsk = set->tasks[i];
+    mm = get_task_mm(w->tsk);
+    if (mm != NULL) {
+      mmgrab(mm);  // keep the mm_struct only
+      mmput(mm);
+    }
+    w->mm = mm;
+    w->ev.pid = task_pid_nr(w->tsk);
+    w->ev.field = ctx->query.field;
+    w->ev.threshold = ctx->query.threshold;
+    if (watch_read(w, &value) && value <= w->ev.threshold)
+      w->ev.flags |= PINFO_WATCH_ABOVE;  // it fires going above
+  }
+  set->nr = 0;  // the references are the watches' now
+  watch_resume(wr);
+  return 0;
+}
+
+/* This function moves the fired watches into the response as events.
+ * Watches that do not fit (in a ring slot) stay for the next call.
+ */
+static void watch_collect(struct pinfo_ctx *ctx)
+{
+  struct pinfo_watcher *wr = ctx->watcher;
+  struct pinfo_watch *w;
+  unsigned int i, j;
+
+  if (wr == NULL)
+    return;
+  watch_pause(wr);
+  for (i = j = 0; i < wr->nr; i++) {
+    w = &wr->watches[i];
+    if (w->fired && pinfo_append(ctx->out, &w->ev, sizeof(w->ev)) == 0) {
+      ((struct pinfo_header *)ctx->out->buf)->count++;
+      watch_put(w);
+      wr->nr_fired--;
+    }
+    else
+      wr->watches[j++] = *w;
+  }
+  wr->nr = j;
+  watch_resume(wr);
+}
+
+/* This function moves the sampler's buffered samples into the
+ * response, CPU by CPU.  The buffer is grown with the lock dropped,
+ * as that can sleep; samples that still do not fit (in a ring slot)
+ * stay buffered for the next drain.
+ */
+static void sampler_drain(struct pinfo_ctx *ctx)
+{
+  struct pinfo_sampler *smp = ctx->sampler;
+  struct pinfo_header *hdr;
+  struct tick_buf *tb;
+  unsigned long irqflags;
+  unsigned int nr, n;
+  int cpu;
+
+  if (smp == NULL)
+    return;
+  for_each_possible_cpu(cpu) {
+    tb = per_cpu_ptr(smp->bufs, cpu);
+    nr = READ_ONCE(tb->nr);
+    if (ctx->out->size - ctx->out->len < nr * sizeof(*tb->ticks))
+      pinfo_grow(ctx->out, nr * sizeof(*tb->ticks));  // copies what fits if it fails
+
+    spin_lock_irqsave(&tb->lock, irqflags);
+    hdr = (struct pinfo_header *)ctx->out->buf;
+    n = min_t(size_t, tb->nr, (ctx->out->size - ctx->out->len) / sizeof(*tb->ticks));
+    memcpy(ctx->out->buf + ctx->out->len, tb->ticks, n * sizeof(*tb->ticks));
+    memmove(tb->ticks, tb->ticks + n, (tb->nr - n) * sizeof(*tb->ticks));
+    tb->nr -= n;
+    ctx->out->len += n * sizeof(*tb->ticks);
+    hdr->count += n;
+    if (tb->dropped != 0)
+      hdr->flags |= PINFO_TRUNCATED;
+    tb->dropped = 0;
+    spin_unlock_irqrestore(&tb->lock, irqflags);
+  }
+}
+
+/* This function is executed when a user program does an open()
+ * of the debugfs file.  It allocates the context for calls made
+ * through the new open file.
+ */
+
+static int getpinfo_open(struct inode *inode, struct file *file)
+{
+  struct pinfo_ctx *ctx;
+
+  ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+  if (ctx == NULL)
+     return -ENOMEM;
+  mutex_init(&ctx->lock);
+  init_waitqueue_head(&ctx->wait);
+  INIT_WORK(&ctx->work, call_work);
+  ctx->resp.size = MAX_ENTRY * MAX_SIBLINGS;
+  ctx->resp.buf = kvmalloc(ctx->resp.size, GFP_KERNEL);
+  if (ctx->resp.buf == NULL || task_set_grow(&ctx->set, MAX_SIBLINGS + 1) != 0) {
+     kvfree(ctx->resp.buf);
+     kfree(ctx);
+     return -ENOMEM;
+  }
+  file->private_data = ctx;
+  return 0;
+}
+
+/* This function is executed on the last close() of an open file
+ * and frees its context, including any response never read.  A call
+ * still running in the worker gives up its waits (a working-set
+ * window or scan, a shared result) rather than keep close() waiting.
+ */
+
+static int getpinfo_release(struct inode *inode, struct file *file)
+{
+  struct pinfo_ctx *ctx = file->private_data;
+
+  // a call running in the worker stops waiting instead of making close() wait
+  WRITE_ONCE(ctx->closing, true);
+  wake_up_all(&ctx->wait);
+  wake_up_all(&pinfo_results_wait);
+  if (cancel_work_sync(&ctx->work))  // it never ran, so drop its reference
+    put_task_struct(ctx->call_task);
+  call_end(ctx);
+  vma_stop(ctx);
+  kvfree(ctx->resp.buf);
+  kvfree(ctx->set.tasks);
+  kvfree(ctx->long_call);
+  kvfree(ctx->pids);
+  kvfree(ctx->top);
+  parts_free(ctx);
+  kfree(ctx->path);
+  kvfree(ctx->key);
+  kvfree(ctx->snap[0].samples);
+  kvfree(ctx->snap[1].samples);
+  if (ctx->sampler != NULL)
+    sampler_free(ctx->sampler);
+  if (ctx->watcher != NULL)
+    watcher_free(ctx->watcher);
+  vfree(ctx->ring);
+  kfree(ctx);
+  return 0;
+}
+
+/* This function formats a line like those of /proc/<pid>/maps for
+ * a VMA, with an L after the permissions for VM_LOCKED.  The caller
+ * holds the mm's mmap_sem.
+ */
+static void gen_vma_string(struct pinfo_ctx *ctx, struct vm_area_struct *vma)
+{
+  struct mm_struct *mm = vma->vm_mm;
+  unsigned long flags = vma->vm_flags;
+  const char *name = "";
+
+  if (vma->vm_file != NULL) {
+    name = file_path(vma->vm_file, ctx->path, PATH_MAX);
+    if (IS_ERR(name))
+      name = "?";
+  }
+  else if (vma->vm_start <= mm->brk && vma->vm_end >= mm->start_brk)
+    name = "[heap]";
+  else if (vma->vm_start <= mm->start_stack && vma->vm_end >= mm->start_stack)
+    name = "[stack]";
+
+  pinfo_printf(&ctx->resp, "  %08lx-%08lx %c%c%c%c%c %08llx %s\n",
+               vma->vm_start, vma->vm_end,
+               flags & VM_READ ? 'r' : '-',
+               flags & VM_WRITE ? 'w' : '-',
+               flags & VM_EXEC ? 'x' : '-',
+               flags & VM_SHARED ? 's' : 'p',
+               flags & VM_LOCKED ? 'L' : '-',
+               (unsigned long long)vma->vm_pgoff << PAGE_SHIFT, name);
+}
+
+/* This function generates the next part of a VMA listing into the
+ * response buffer, stopping once it holds about PINFO_STREAM_CHUNK
+ * bytes.
+ *
+ * Like a seq_file, the listing is generated as it is read, so it is
+ * never held whole and can be of any size.  Each part is generated
+ * under the mm's mmap_sem, which is dropped between parts; the next
+ * part starts at the first VMA ending after the last one listed, so
+ * VMAs changed in between are listed as they are then.  The mm is held
+ * with mmget() (get_task_mm()) from the first part to the last.
+ */
+#define PINFO_STREAM_CHUNK (16 * 1024)
+
+static int vma_fill(struct pinfo_ctx *ctx)
+{
+  struct pinfo_buf *resp = &ctx->resp;
+  struct task_struct *tsk;
+  struct vm_area_struct *vma;
+  struct mm_struct *mm;
+
+  while (resp->len < PINFO_STREAM_CHUNK) {
+    if (ctx->vma_mm == NULL) {  // start on the next task
+      if (ctx->vma_task == ctx->set.nr) {
+        task_set_put(&ctx->set);
+        ctx->more = false;
+        return 0;
+      }
+      tsk = ctx->set.tasks[ctx->vma_task];
+      if (tsk == NULL) {
+        pinfo_printf(resp, "PID %d: no such process\n", ctx->pids[ctx->vma_task++]);
+        continue;
+      }
+      ctx->vma_task++;
+      pinfo_printf(resp, "VMAs of PID %d\n", task_pid_nr(tsk));
+      ctx->vma_mm = get_task_mm(tsk);
+      ctx->vma_next = 0;
+      continue;  // no user memory lists no VMAs
+    }
+
+    mm = ctx->vma_mm;
+    if (down_read_killable(&mm->mmap_sem))
+      return -EINTR;
+    for (vma = find_vma(mm, ctx->vma_next); vma != NULL && resp->len < PINFO_STREAM_CHUNK;
+         vma = vma->vm_next) {
+      gen_vma_string(ctx, vma);
+      ctx->vma_next = vma->vm_end;
+    }
+    up_read(&mm->mmap_sem);
+    if (vma == NULL) {  // done with this task
+      mmput(mm);
+      ctx->vma_mm = NULL;
+    }
+    cond_resched();
+  }
+  return 0;
+}
+
+/* This function drops what a VMA listing not read to its end holds */
+static void vma_stop(struct pinfo_ctx *ctx)
+{
+  if (ctx->vma_mm != NULL)
+    mmput(ctx->vma_mm);
+  ctx->vma_mm = NULL;
+  task_set_put(&ctx->set);
+  ctx->more = false;
+}
+
+/* Pages found accessed (hot) and not accessed (cold), and the page
+ * table entries looked at, during a working-set scan.
+ */
+struct wss_count {
+  unsigned long hot;
+  unsigned long cold;
+  unsigned long work;
+};
+
+/* These functions test and clear the accessed bit of a page table
+ * entry, or of a huge page's PMD.  The kernel's own
+ * ptep_test_and_clear_young() and pmdp_test_and_clear_young() are
+ * out of line and not exported on x86, so there the bit is cleared
+ * with the same atomic bit operation they use; other architectures
+ * define them in their headers.  The caller holds the page table lock.
+ */
+static int wss_clear_young_pte(struct vm_area_struct *vma, unsigned long addr, pte_t *pte)
+{
+#ifdef CONFIG_X86
+  return pte_young(*pte) && test_and_clear_bit(_PAGE_BIT_ACCESSED, (unsigned long *)&pte->pte);
+#else
+  return ptep_test_and_clear_young(vma, addr, pte);
+#endif
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static int wss_clear_young_pmd(struct vm_area_struct *vma, unsigned long addr, pmd_t *pmd)
+{
+#ifdef CONFIG_X86
+  return pmd_young(*pmd) && test_and_clear_bit(_PAGE_BIT_ACCESSED, (unsigned long *)pmd);
+#else
+  return pmdp_test_and_clear_young(vma, addr, pmd);
+#endif
+}
+#endif
+
+/* This function tests and clears the accessed bits of the pages
+ * mapped by a page table (or a huge page) within a VMA, as the
+ * clear_refs code of /proc/<pid>/clear_refs does.  It is the pmd_entry
+ * callback of the kernel's page walker, called with mmap_sem held;
+ * the walker does not split a huge PMD when a pmd_entry is given, so
+ * a huge one is handled here under its lock.
+ *
+ * The TLB is not flushed: like x86's ptep_clear_flush_young(), this
+ * relies on cached translations being evicted soon (at the latest on
+ * a context switch), after which an access sets the bit again.  A page
+ * accessed only through a translation cached all through the window
+ * can be counted as cold.
  */
+static int wss_pmd_entry(pmd_t *pmd, unsigned long addr, unsigned long end,
+                         struct mm_walk *walk)
+{
+  struct wss_count *c = walk->private;
+  struct vm_area_struct *vma = walk->vma;
+  pte_t *pte, *start_pte;
+  spinlock_t *ptl;
 
-struct task_struct *call_task = NULL;
-char *respbuf;  // points to memory allocated to return the result
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+  if (pmd_trans_huge(READ_ONCE(*pmd))) {
+    ptl = pmd_lock(walk->mm, pmd);
+    if (pmd_trans_huge(*pmd)) {  // not split while the lock was taken
+      if (wss_clear_young_pmd(vma, addr, pmd))
+        c->hot += HPAGE_PMD_NR;
+      else
+        c->cold += HPAGE_PMD_NR;
+      c->work++;
+      spin_unlock(ptl);
+      return 0;
+    }
+    spin_unlock(ptl);
+  }
+#endif
+  if (pmd_trans_unstable(pmd))
+    return 0;
 
-int file_value;
-struct dentry *dir, *file;  // used to set up debugfs file name
+  start_pte = pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+  for (; addr != end; pte++, addr += PAGE_SIZE) {
+    c->work++;
+    if (!pte_present(*pte))
+      continue;
+    if (wss_clear_young_pte(vma, addr, pte))
+      c->hot++;
+    else
+      c->cold++;
+  }
+  pte_unmap_unlock(start_pte, ptl);
+  return 0;
+}
+
+/* This function scans [addr, end) of a VMA with the page walker, whose
+ * callbacks moved from struct mm_walk to struct mm_walk_ops in 5.4.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 4, 0)
+static const struct mm_walk_ops wss_walk_ops = {
+  .pmd_entry = wss_pmd_entry,
+};
+
+static void wss_range(struct vm_area_struct *vma, unsigned long addr, unsigned long end,
+                      struct wss_count *c)
+{
+  walk_page_range(vma->vm_mm, addr, end, &wss_walk_ops, c);
+}
+#else
+static void wss_range(struct vm_area_struct *vma, unsigned long addr, unsigned long end,
+                      struct wss_count *c)
+{
+  struct mm_walk walk = {
+    .pmd_entry = wss_pmd_entry,
+    .mm = vma->vm_mm,
+    .private = c,
+  };
+
+  walk_page_range(addr, end, &walk);
+}
+#endif
+
+/* This function takes mmap_sem for a working-set scan, backing off
+ * while writers use it, so that the target is not held up.
+ */
+static int wss_lock(struct pinfo_ctx *ctx, struct mm_struct *mm)
+{
+  int i;
+
+  for (i = 0; i < PINFO_WSS_TRIES; i++) {
+    if (down_read_trylock(&mm->mmap_sem))
+      return 0;
+    if (fatal_signal_pending(current) || READ_ONCE(ctx->closing))
+      return -EINTR;
+    usleep_range(PINFO_WSS_PAUSE_US, 2 * PINFO_WSS_PAUSE_US);
+  }
+  return down_read_killable(&mm->mmap_sem) ? -EINTR : 0;
+}
+
+static void wss_report(struct pinfo_ctx *ctx, unsigned long start, unsigned long end,
+                       const struct wss_count *c, struct wss_count *total)
+{
+  pinfo_printf(&ctx->resp, "  %08lx-%08lx hot %lu cold %lu\n", start, end, c->hot, c->cold);
+  total->hot += c->hot;
+  total->cold += c->cold;
+}
+
+/* This function scans the page tables of an mm once, testing and
+ * clearing the accessed bit of every mapped page.  With report set,
+ * it adds a line for each VMA with the pages that were accessed since
+ * the previous scan, and the totals, to the response.
+ *
+ * The scan goes at most a PMD's range at a time and stops for a pause
+ * every PINFO_WSS_BATCH entries, dropping mmap_sem, to bound both the
+ * CPU it uses and the time the target's mmap_sem is held.  It then
+ * resumes at the address where it stopped.  Huge TLB and PFN mappings
+ * have no pages to scan.
+ */
+static int wss_pass(struct pinfo_ctx *ctx, struct mm_struct *mm, bool report)
+{
+  struct wss_count c = { 0 }, total = { 0 };
+  struct vm_area_struct *vma;
+  unsigned long addr = 0, end;
+  unsigned long vm_start = 0, vm_end = 0;  // the VMA being counted
+  int rc;
+
+  for (;;) {
+    if (READ_ONCE(ctx->closing))  // the file was closed, nobody will read this
+      return -EINTR;
+    rc = wss_lock(ctx, mm);
+    if (rc != 0)
+      return rc;
+    c.work = 0;
+    vma = find_vma(mm, addr);
+    while (vma != NULL && c.work < PINFO_WSS_BATCH) {
+      if (vma->vm_start != vm_start) {  // on to the next VMA
+        if (report && vm_end != 0)
+          wss_report(ctx, vm_start, vm_end, &c, &total);
+        vm_start = vma->vm_start;
+        vm_end = vma->vm_end;
+        c.hot = c.cold = 0;
+      }
+      addr = max(addr, vma->vm_start);
+      end = min(vma->vm_end, (addr + PMD_SIZE) & PMD_MASK);
+      if (!(vma->vm_flags & (VM_HUGETLB | VM_PFNMAP | VM_IO)))
+        wss_range(vma, addr, end, &c);
+      c.work++;
+      addr = end;
+      if (addr == vma->vm_end)
+        vma = vma->vm_next;
+    }
+    up_read(&mm->mmap_sem);
+    if (vma == NULL)
+      break;
+    usleep_range(PINFO_WSS_PAUSE_US, 2 * PINFO_WSS_PAUSE_US);
+  }
+  if (report) {
+    if (vm_end != 0)
+      wss_report(ctx, vm_start, vm_end, &c, &total);
+    pinfo_printf(&ctx->resp, "  total hot %lu cold %lu pages\n", total.hot, total.cold);
+  }
+  return 0;
+}
+
+/* This function estimates the working set of each task collected for
+ * the call: a first scan clears the accessed bits, and a second one
+ * after window_ms counts the pages accessed in between (hot) and the
+ * other mapped pages (cold).  Threads sharing an mm are scanned once.
+ * Clearing the bits also makes the pages look unused to reclaim, as
+ * with clear_refs.
+ */
+static int gen_wss(struct pinfo_ctx *ctx)
+{
+  struct mm_struct *mms[MAX_WSS];
+  pid_t pids[MAX_WSS];
+  struct task_struct *tsk;
+  struct mm_struct *mm;
+  unsigned int i, j, nr = 0;
+  int rc = 0;
+
+  for (i = 0; i < ctx->set.nr; i++) {
+    tsk = ctx->set.tasks[i];
+    if (tsk == NULL) {
+      pinfo_printf(&ctx->resp, "PID %d: no such process\n", ctx->pids[i]);
+      continue;
+    }
+    mm = get_task_mm(tsk);
+    if (mm == NULL) {
+      pinfo_printf(&ctx->resp, "PID %d: no user memory\n", task_pid_nr(tsk));
+      continue;
+    }
+    for (j = 0; j < nr && mms[j] != mm; j++)
+      ;
+    if (j < nr || nr == MAX_WSS) {  // a thread of a process already in, or too many
+      mmput(mm);
+      if (j == nr)
+        rc = -E2BIG;
+      continue;
+    }
+    mms[nr] = mm;
+    pids[nr++] = task_pid_nr(tsk);
+  }
+
+  for (i = 0; i < nr && rc == 0; i++)
+    rc = wss_pass(ctx, mms[i], false);
+  if (rc == 0 && wait_event_interruptible_timeout(ctx->wait, READ_ONCE(ctx->closing),
+                                                 msecs_to_jiffies(ctx->query.window_ms)) != 0)
+    rc = -EINTR;  // a signal, or the file was closed
+  for (i = 0; i < nr && rc == 0; i++) {
+    pinfo_printf(&ctx->resp, "Working set of PID %d over %u ms\n", pids[i], ctx->query.window_ms);
+    rc = wss_pass(ctx, mms[i], true);
+  }
+
+  for (i = 0; i < nr; i++)
+    mmput(mms[i]);
+  return rc;
+}
+
+/* This function executes a parsed call and prepares its response.
+ * It runs in the write() of the call, or in a worker for a call
+ * made with O_NONBLOCK, with the context's mutex held either way.
+ * Returns 0, or an error for the call as a whole.
+ */
+
+static int run_call(struct pinfo_ctx *ctx)
+{
+  int rc;
+  struct pinfo_buf *resp = &ctx->resp;
+  struct pinfo_buf slot_buf;
+
+  ctx->out = resp;
+  if (ctx->query.ring) { // build the response in the ring, nothing is read
+      if (ring_alloc(ctx) != 0)
+         return -ENOMEM;
+      ring_begin(ctx, &slot_buf);
+      ctx->out = &slot_buf;
+  }
+
+  if (ctx->query.binary) { // the record count is filled in at the end
+      struct pinfo_header hdr = {
+        .magic = PINFO_MAGIC,
+        .version = PINFO_VERSION,
+        .rec_size = sizeof(struct pinfo_record),
+      };
+      if (ctx->query.drain) {
+         hdr.rec_size = sizeof(struct pinfo_tick);
+         hdr.flags = PINFO_TICKS;
+      }
+      else if (ctx->query.watches) {
+         hdr.rec_size = sizeof(struct pinfo_event);
+         hdr.flags = PINFO_EVENTS;
+      }
+      else {
+         if (ctx->query.sched) {
+            hdr.rec_size += sizeof(struct pinfo_sched);
+            hdr.flags |= PINFO_SCHED;
+         }
+         if (ctx->query.mem) {
+            hdr.rec_size += sizeof(struct pinfo_mem);
+            hdr.flags |= PINFO_MEM;
+         }
+         if (ctx->query.io) {
+            hdr.rec_size += sizeof(struct pinfo_io);
+            hdr.flags |= PINFO_IO;
+         }
+      }
+      pinfo_append(ctx->out, &hdr, sizeof(hdr));
+  }
+
+  // find the tasks to report on, then generate the pinfo for each of them
+  if (ctx->query.drain || ctx->query.watches)
+      rc = 0;
+  else
+      rc = ctx->query.top ? collect_top(ctx) : collect_tasks(ctx);
+  if (rc == -ESRCH) {  // binary responses just have no records
+      if (!ctx->query.binary)
+         pinfo_printf(resp, "Failed: no such process\n");
+  }
+  else if (rc != 0)
+      return rc;
+  if (ctx->query.drain)
+      sampler_drain(ctx);
+  else if (ctx->query.watches)
+      watch_collect(ctx);
+  else if (ctx->query.watch) {
+      rc = watch_add(ctx);
+      if (rc == 0 && !ctx->query.binary)
+         pinfo_printf(resp, "Watching %u tasks\n", ctx->watcher->nr - ctx->watcher->nr_fired);
+  }
+  else if (ctx->query.sample) {
+      rc = sampler_arm(ctx);
+      if (rc == 0 && !ctx->query.binary && ctx->query.period_us != 0)
+         pinfo_printf(resp, "Sampling %u tasks every %u us\n", ctx->sampler->nr, ctx->query.period_us);
+      else if (rc == 0 && !ctx->query.binary)
+         pinfo_printf(resp, "Sampling stopped\n");
+  }
+  else if (ctx->query.delta)
+      rc = gen_delta(ctx);
+  else if (ctx->query.wss)
+      rc = gen_wss(ctx);
+  else if (ctx->query.vmas) {  // generated as it is read
+      if (ctx->path == NULL)
+         ctx->path = kmalloc(PATH_MAX, GFP_KERNEL);
+      if (ctx->path == NULL)
+         rc = -ENOMEM;
+      else {
+         ctx->vma_task = 0;
+         ctx->more = true;
+      }
+  }
+  else {
+      bool truncated = false;
+      u32 count;
+
+      if (ctx->query.parallel)
+         count = gen_parallel(ctx, &truncated);
+      else
+         count = gen_range(ctx, ctx->out, 0, ctx->set.nr, &truncated);
+      if (ctx->query.binary) {
+         struct pinfo_header *hdr = (struct pinfo_header *)ctx->out->buf;
+
+         hdr->count += count;
+         if (truncated)
+            hdr->flags |= PINFO_TRUNCATED;
+      }
+  }
+  if (!ctx->more)  // a VMA listing keeps its tasks
+      task_set_put(&ctx->set);
+  if (rc != 0 && rc != -ESRCH)
+      return rc;
+
+  // cleanup code at end
+  if (ctx->query.binary) {
+      struct pinfo_header *hdr = (struct pinfo_header *)ctx->out->buf;
+      printk(KERN_DEBUG "getpinfo: call from pid %d will return %u records\n", ctx->call_task->pid, hdr->count);
+  }
+  else
+      printk(KERN_DEBUG "getpinfo: call from pid %d will return %zu bytes\n", ctx->call_task->pid, resp->len);
+  if (ctx->query.ring) {
+      ring_publish(ctx, &slot_buf);
+      call_end(ctx);  // there is nothing to read
+  }
+  return 0;
+}
+
+static void result_free(struct kref *ref)
+{
+  struct pinfo_result *r = container_of(ref, struct pinfo_result, ref);
+
+  put_pid_ns(r->ns);
+  kvfree(r->key);
+  kvfree(r->buf);
+  kfree(r);
+}
+
+/* This function takes a result off the list; pinfo_results_lock is held */
+static void result_unlink(struct pinfo_result *r)
+{
+  list_del(&r->node);
+  nr_results--;
+  kref_put(&r->ref, result_free);
+}
+
+static bool result_is(const struct pinfo_result *r, const struct pid_namespace *ns,
+                      pid_t caller, const char *key)
+{
+  return r->ns == ns && r->caller == caller && strcmp(r->key, key) == 0;
+}
+
+/* This function finds the result a shared call can use, or else puts
+ * a new one on the list for the call to make, setting *lead.  NULL
+ * means the call is not shared.  The result is referenced for the
+ * caller.  Results older than PINFO_FRESH_MAX_MS are dropped on the
+ * way, as are older results for the key of a new one; if the list is
+ * full, its oldest finished result makes room.
+ */
+static struct pinfo_result *result_get(struct pinfo_ctx *ctx, bool *lead)
+{
+  struct pinfo_query *q = &ctx->query;
+  struct pid_namespace *ns = ctx->call_ns;
+  pid_t caller = 0;
+  struct pinfo_result *r, *tmp, *found = NULL;
+  u64 now;
+
+  // a top call without a tree ranks every process, whoever makes it
+  if ((q->scope == SCOPE_SIBLINGS && q->top == 0) || (q->scope == SCOPE_TREE && q->root == 0))
+    caller = pid_nr(ctx->call_pid);
+  *lead = false;
+  mutex_lock(&pinfo_results_lock);
+  now = ktime_get_ns();  // no result was made later
+  list_for_each_entry_safe(r, tmp, &pinfo_results, node) {
+    if (r->ready && now - r->time_ns > PINFO_FRESH_MAX_MS * NSEC_PER_MSEC) {
+      result_unlink(r);
+      continue;
+    }
+    if (!result_is(r, ns, caller, ctx->key))
+      continue;
+    if ((!r->ready && q->share) ||
+        (r->ready && now - r->time_ns <= q->fresh_ms * NSEC_PER_MSEC)) {
+      found = r;
+      kref_get(&r->ref);
+      goto out;
+    }
+  }
+
+  list_for_each_entry_safe(r, tmp, &pinfo_results, node) {
+    if (r->ready && (nr_results >= PINFO_MAX_RESULTS || result_is(r, ns, caller, ctx->key)))
+      result_unlink(r);
+  }
+  if (nr_results >= PINFO_MAX_RESULTS)  // all are being made
+    goto out;
+  found = kzalloc(sizeof(*found), GFP_KERNEL);
+  if (found == NULL)
+    goto out;
+  found->key = kvmalloc(strlen(ctx->key) + 1, GFP_KERNEL);
+  if (found->key == NULL) {
+    kfree(found);
+    found = NULL;
+    goto out;
+  }
+  strcpy(found->key, ctx->key);
+  found->ns = get_pid_ns(ns);
+  found->caller = caller;
+  init_completion(&found->done);
+  kref_init(&found->ref);  // for the list
+  kref_get(&found->ref);
+  list_add_tail(&found->node, &pinfo_results);
+  nr_results++;
+  *lead = true;
+out:
+  mutex_unlock(&pinfo_results_lock);
+  return found;
+}
+
+/* This function finishes a result with the response the call made,
+ * NULL if it failed, and wakes up the calls waiting for it.
+ */
+static void result_put_response(struct pinfo_result *r, const struct pinfo_buf *resp)
+{
+  char *buf = NULL;
+
+  if (resp != NULL)
+    buf = kvmalloc(resp->len + 1, GFP_KERNEL);
+  if (buf != NULL) {
+    memcpy(buf, resp->buf, resp->len);
+    buf[resp->len] = '\0';
+  }
+  mutex_lock(&pinfo_results_lock);
+  r->buf = buf;
+  r->len = buf != NULL ? resp->len : 0;
+  r->time_ns = ktime_get_ns();
+  r->ready = true;
+  if (buf == NULL)  // nothing to share
+    result_unlink(r);
+  mutex_unlock(&pinfo_results_lock);
+  complete_all(&r->done);
+  wake_up_all(&pinfo_results_wait);
+}
+
+/* This function runs a call, sharing the response with identical
+ * calls if it asked for it.
+ *
+ * The first of identical calls makes the response while the others
+ * wait for it, each holding only its own context's lock; a call that
+ * takes an earlier response does not wait at all.  A call whose
+ * response could not be shared makes its own.  A waiting call in a
+ * worker also gives up if its file is closed.
+ */
+static int serve_call(struct pinfo_ctx *ctx)
+{
+  struct pinfo_result *r;
+  bool lead;
+  int rc;
+
+  if (!ctx->query.share && ctx->query.fresh_ms == 0)
+    return run_call(ctx);
+  r = result_get(ctx, &lead);
+  if (r == NULL)
+    return run_call(ctx);
+  if (lead) {
+    rc = run_call(ctx);
+    result_put_response(r, rc == 0 ? &ctx->resp : NULL);
+  }
+  else if (wait_event_killable(pinfo_results_wait,
+                               completion_done(&r->done) || READ_ONCE(ctx->closing)) != 0 ||
+           !completion_done(&r->done))
+    rc = -EINTR;
+  else if (r->buf == NULL)
+    rc = run_call(ctx);
+  else if (pinfo_append(&ctx->resp, r->buf, r->len + 1) != 0)
+    rc = -ENOMEM;
+  else {
+    ctx->resp.len--;  // the '\0' keeps text a string
+    printk(KERN_DEBUG "getpinfo: call from pid %d will return %zu shared bytes\n",
+           ctx->call_task->pid, ctx->resp.len);
+    rc = 0;
+  }
+  kref_put(&r->ref, result_free);
+  return rc;
+}
+
+/* This function runs a call made with O_NONBLOCK, holding a reference
+ * to the calling task taken by the write().  An error is kept for the
+ * read() of the response.
+ */
+
+static void call_work(struct work_struct *work)
+{
+  struct pinfo_ctx *ctx = container_of(work, struct pinfo_ctx, work);
+  struct task_struct *caller;
 
-static int gen_pinfo_string(char *buf, struct task_struct *tsk);
+  mutex_lock(&ctx->lock);
+  caller = ctx->call_task;
+  ctx->async_rc = serve_call(ctx);
+  WRITE_ONCE(ctx->busy, false);
+  mutex_unlock(&ctx->lock);
+  wake_up_interruptible_poll(&ctx->wait, EPOLLIN | EPOLLRDNORM);
+  put_task_struct(caller);
+}
 
 /* This function emulates the handling of a system call by
  * accessing the call string from the user program, executing
@@ -47,7 +2189,17 @@ static int gen_pinfo_string(char *buf, struct task_struct *tsk);
  * maximum size of the buffer content.
  *
  * The user space program is blocked at the write() call until
- * this function returns.
+ * this function returns.  A response of any size is kept for the
+ * read() calls that follow.
+ *
+ * If the file was opened with O_NONBLOCK, the call is only checked
+ * and queued to run in a worker, and write() returns at once; poll()
+ * reports EPOLLIN once the call has run, and read() returns -EAGAIN
+ * until then.  A file has one call in flight at a time, so a
+ * program with many calls in flight opens the file once for each.
+ *
+ * A call listing pids can be up to MAX_PIDS_CALL characters; those of
+ * MAX_CALL or more are copied into a buffer kept in the context.
  */
 
 static ssize_t getpinfo_call(struct file *file, const char __user *buf,
@@ -55,58 +2207,238 @@ static ssize_t getpinfo_call(struct file *file, const char __user *buf,
 {
   int rc;
   char callbuf[MAX_CALL];  // local (kernel) space to store call string
-  int i = 0;
-  struct task_struct *pos;
+  char *call = callbuf;
+  struct pinfo_ctx *ctx = file->private_data;
+  struct pinfo_buf *resp = &ctx->resp;
   
-  // the user's write() call should not include a count that exceeds MAX_CALL
-  if(count >= MAX_CALL)
+  // the user's write() call should not include a count that exceeds MAX_PIDS_CALL
+  if(count >= MAX_PIDS_CALL)
     return -EINVAL;  // return the invalid error code
+  if (READ_ONCE(ctx->busy))  // do not wait for the mutex behind a worker
+    return -EAGAIN;
   
-  // Prevent preemption.  
-  preempt_disable();  
-  if (call_task != NULL) { // a different process is expecting a return
-     preempt_enable();  // must be enabled before return
+  mutex_lock(&ctx->lock);
+  if (ctx->call_task != NULL) { // a response on this file is still expected
+     mutex_unlock(&ctx->lock);  // must be released before return
      return -EAGAIN;
   }
 
-  // allocate some kernel memory for the response
-  respbuf = kmalloc(MAX_ENTRY * MAX_SIBLINGS, GFP_ATOMIC);
-  if (respbuf == NULL) {  // test if allocation failed
-     preempt_enable(); 
-     return -ENOSPC;
-  }
-  strcpy(respbuf,""); /* initialize buffer with null string */
+  pinfo_reset(resp); /* initialize buffer with null string */
+  ctx->win_start = 0;
   
-  call_task = current;  // this returns a pointer to the structure of the calling task
-  rc = copy_from_user(callbuf, buf, count);
-  callbuf[MAX_CALL - 1] = '\0'; /* make sure it is a terminated string */
-
-  if (strcmp(callbuf, "getpinfo") != 0) { // only valid call is "getpinfo"
-      strcpy(respbuf, "Failed: invalid operation\n");
-      printk(KERN_DEBUG "getpinfo: call %s will return %s\n", callbuf, respbuf);  // goes into /var/log/kern.log
-      preempt_enable();
-      return count;  /* write() calls return the number of bytes written */
+  if (count >= MAX_CALL) {
+      if (ctx->long_call == NULL)
+         ctx->long_call = kvmalloc(MAX_PIDS_CALL, GFP_KERNEL);
+      if (ctx->long_call == NULL) {
+         mutex_unlock(&ctx->lock);
+         return -ENOMEM;
+      }
+      call = ctx->long_call;
   }
+  if (copy_from_user(call, buf, count)) {
+      mutex_unlock(&ctx->lock);
+      return -EFAULT;
+  }
+  call[count] = '\0'; /* make sure it is a terminated string */
+  ctx->call_task = current;  // this returns a pointer to the structure of the calling task
+  ctx->call_pid = get_task_pid(current, PIDTYPE_PID);
+  ctx->call_ns = get_pid_ns(task_active_pid_ns(current));
+  printk(KERN_DEBUG "getpinfo: call %.*s from pid %d\n", MAX_CALL, call, current->pid);  // goes into /var/log/kern.log
 
-  // generate the pinfo string for the current process
-  rc = gen_pinfo_string(respbuf, call_task);
-
-  // traverse through my siblings and generate pinfo string for each of them
-  list_for_each_entry(pos, &(call_task->sibling), sibling){
-    if (i < MAX_SIBLINGS) {
-      rc = gen_pinfo_string(respbuf, pos);
-      i++;
-    } else break;
+  rc = parse_call(ctx, call);
+  if (rc != 0) {
+      memset(&ctx->query, 0, sizeof(ctx->query));  // failures are reported as text
+      pinfo_printf(resp, rc == -ENOMEM ? "Failed: out of memory\n" : "Failed: invalid operation\n");
+      printk(KERN_DEBUG "getpinfo: call from pid %d will return %s", current->pid, resp->buf);
+      ctx->win_start = 0;
+      *ppos = 0;  /* the message is read from its start */
+      mutex_unlock(&ctx->lock);
+      return count;  /* write() calls return the number of bytes written */
   }
 
-  // cleanup code at end
-  printk(KERN_DEBUG "getpinfo: call %s will return %s", callbuf, respbuf);
-  preempt_enable();
+  if (file->f_flags & O_NONBLOCK) {
+      get_task_struct(current);  // for the worker, put when it is done
+      ctx->async_rc = 0;
+      WRITE_ONCE(ctx->busy, true);
+      queue_work(getpinfo_wq, &ctx->work);
+  }
+  else {
+      rc = serve_call(ctx);
+      if (rc != 0) {
+         call_end(ctx);
+         mutex_unlock(&ctx->lock);
+         return rc;
+      }
+  }
+  mutex_unlock(&ctx->lock);
   *ppos = 0;  /* reset the offset to zero */
   return count;  /* write() calls return the number of bytes */
 }
 
-  /* This function parses the task_struct and formats a string with the info
+/* This function reads the VM counters of a task's mm.
+ *
+ * A monitor must not add latency to the tasks it watches, so it never
+ * waits for mmap_sem: a writer holding it (a fault or mmap() in the
+ * target) would stall the monitor, and a waiting reader would in turn
+ * hold off the target's next writer.  If the lock is free the counters
+ * are read under it as a consistent snapshot; otherwise each is read
+ * once without it, which is safe as they are plain words, and the
+ * sample is marked as such.  The reference from get_task_mm() keeps
+ * the mm from being freed if the task exits meanwhile, and is NULL for
+ * kernel threads.  The resident page counts are kept in atomic
+ * counters, locked_vm is a plain word, and pinned_vm is one too before
+ * Linux 5.1 and an atomic64_t since, so the "mem" fields are always
+ * read without the lock.
+ */
+static void sample_vm(const struct pinfo_query *q, struct task_struct *tsk,
+                      struct pinfo_sample *s)
+{
+  struct pinfo_record *rec = &s->rec;
+  struct mm_struct *mm;
+
+  mm = get_task_mm(tsk);
+  if (mm == NULL) {  // kernel threads have no user memory
+    rec->vm_sample = PINFO_VM_NONE;
+    return;
+  }
+  if (down_read_trylock(&mm->mmap_sem)) {
+    rec->vm_sample = PINFO_VM_LOCKED;
+    rec->map_count = mm->map_count;
+    rec->shared_vm = mm->shared_vm;
+    rec->exec_vm = mm->exec_vm;
+    rec->stack_vm = mm->stack_vm;
+    rec->total_vm = mm->total_vm;
+    up_read(&mm->mmap_sem);
+  }
+  else {
+    rec->vm_sample = PINFO_VM_LOCKLESS;
+    rec->map_count = READ_ONCE(mm->map_count);
+    rec->shared_vm = READ_ONCE(mm->shared_vm);
+    rec->exec_vm = READ_ONCE(mm->exec_vm);
+    rec->stack_vm = READ_ONCE(mm->stack_vm);
+    rec->total_vm = READ_ONCE(mm->total_vm);
+  }
+  if (q->mem) {
+    s->mem.rss_anon = get_mm_counter(mm, MM_ANONPAGES);
+    s->mem.rss_file = get_mm_counter(mm, MM_FILEPAGES);
+    s->mem.rss_shmem = get_mm_counter(mm, MM_SHMEMPAGES);
+    s->mem.locked_vm = READ_ONCE(mm->locked_vm);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 1, 0)
+    s->mem.pinned_vm = atomic64_read(&mm->pinned_vm);
+#else
+    s->mem.pinned_vm = READ_ONCE(mm->pinned_vm);
+#endif
+  }
+  rec->sample_ns = ktime_get_ns();
+  mmput(mm);
+}
+
+/* This function reads a task's scheduler details.  Those of other
+ * threads of its group are added to the run queue counters when
+ * reporting a group.
+ */
+static void sample_sched(struct task_struct *tsk, struct pinfo_sched *sc, bool add)
+{
+  if (!add) {
+    sc->cpu = task_cpu(tsk);
+    sc->policy = READ_ONCE(tsk->policy);
+    sc->prio = READ_ONCE(tsk->prio);
+    sc->static_prio = READ_ONCE(tsk->static_prio);
+    sc->rt_priority = READ_ONCE(tsk->rt_priority);
+    sc->run_delay_ns = sc->pcount = 0;
+  }
+#ifdef CONFIG_SCHED_INFO
+  sc->run_delay_ns += READ_ONCE(tsk->sched_info.run_delay);
+  sc->pcount += READ_ONCE(tsk->sched_info.pcount);
+#endif
+}
+
+/* This function adds up the CPU counters of a thread group, which a
+ * record for its leader reports.  Threads that have exited left theirs
+ * in the signal_struct, which lives as long as the leader's
+ * task_struct.  The counters of running threads are read as they are.
+ */
+static void sample_group(const struct pinfo_query *q, struct task_struct *leader,
+                         struct pinfo_sample *s)
+{
+  struct signal_struct *sig = leader->signal;
+  struct pinfo_record *rec = &s->rec;
+  struct task_struct *t;
+
+  rec->nr_threads = 0;
+  rec->runtime_ns = READ_ONCE(sig->sum_sched_runtime);
+  rec->nvcsw = READ_ONCE(sig->nvcsw);
+  rec->nivcsw = READ_ONCE(sig->nivcsw);
+  if (q->mem) {
+    s->mem.min_flt = READ_ONCE(sig->min_flt);
+    s->mem.maj_flt = READ_ONCE(sig->maj_flt);
+  }
+  if (q->io)
+    io_add(&s->io, &sig->ioac);
+  rcu_read_lock();
+  for_each_thread(leader, t) {
+    rec->nr_threads++;
+    rec->runtime_ns += READ_ONCE(t->se.sum_exec_runtime);
+    rec->nvcsw += READ_ONCE(t->nvcsw);
+    rec->nivcsw += READ_ONCE(t->nivcsw);
+    if (q->sched && t != leader)
+      sample_sched(t, &s->sched, true);
+    if (q->mem) {
+      s->mem.min_flt += READ_ONCE(t->min_flt);
+      s->mem.maj_flt += READ_ONCE(t->maj_flt);
+    }
+    if (q->io)
+      io_add(&s->io, &t->ioac);
+  }
+  rcu_read_unlock();
+}
+
+/* This function copies the info reported for a task out of its
+ * task_struct into a record.  Returns -1 for tasks not reported.
+ */
+static int sample_task(const struct pinfo_query *q, struct task_struct *tsk,
+                       struct pinfo_sample *s)
+{
+  struct pinfo_record *rec = &s->rec;
+  pid_t cur_pid = 0;
+
+  cur_pid = task_pid_nr(tsk); //Use kernel functions for access to pid for a process 
+  if (cur_pid == 1) return -1;
+  pr_debug("getpinfo: starting  response for pid %d\n", cur_pid);  // dynamic debug, as there may be many
+
+  memset(s, 0, sizeof(*s));
+  rec->pid = cur_pid;
+  get_task_comm(s->comm, tsk);  // use kernel function for access to command name
+  rcu_read_lock();
+  rec->ppid = task_pid_nr(rcu_dereference(tsk->real_parent));
+  rcu_read_unlock();
+  rec->state = tsk->state;
+  rec->flags = tsk->flags;
+  rec->normal_prio = tsk->normal_prio;
+  if (q->sched)
+    sample_sched(tsk, &s->sched, false);
+  if (q->groups)
+    sample_group(q, tsk, s);
+  else {
+    rec->nr_threads = 1;
+    rec->runtime_ns = READ_ONCE(tsk->se.sum_exec_runtime);
+    rec->nvcsw = READ_ONCE(tsk->nvcsw);
+    rec->nivcsw = READ_ONCE(tsk->nivcsw);
+    if (q->mem) {
+      s->mem.min_flt = READ_ONCE(tsk->min_flt);
+      s->mem.maj_flt = READ_ONCE(tsk->maj_flt);
+    }
+    if (q->io)
+      io_add(&s->io, &tsk->ioac);
+  }
+  if (q->io)
+    s->io_ns = ktime_get_ns();
+
+  sample_vm(q, tsk, s);
+  return 0;
+}
+
+  /* This function formats a string with the info in a record
    * The string will include:
    * Current PID 5234
    *   command caller      (comm)
@@ -119,62 +2451,419 @@ static ssize_t getpinfo_call(struct file *file, const char __user *buf,
    *   VM exec 457         (exec_vm)
    *   VM stack 34         (stack_vm)
    *   VM total 507        (total_vm)
+   *   VM sample locked at 81234567890 ns
+   *   threads 1           (live threads, with "groups")
+   *   CPU time 1234567 ns (se.sum_exec_runtime)
+   *   context switches 12 voluntary, 3 involuntary
+   * and with "sched":
+   *   last CPU 2          (task_cpu)
+   *   policy 0, priority 120, static 120, real-time 0
+   *   run queue wait 56789 ns over 40 runs   (sched_info)
+   * and with "mem":
+   *   RSS anon 120, file 310, shmem 0          (get_mm_counter)
+   *   VM locked 0, pinned 0
+   *   page faults 1450 minor, 2 major
+   * and with "io":
+   *   I/O read 52345 bytes in 120 calls, 4096 from storage    (ioac)
+   *   I/O written 1024 bytes in 8 calls, 0 to storage, 0 cancelled
+   *   I/O rate read 1200, written 0, storage 0/0 bytes/s over 1000000000 ns
    */
-static int gen_pinfo_string(char *buf, struct task_struct *tsk)
+static int gen_pinfo_string(struct pinfo_buf *pb, const struct pinfo_query *q,
+                            const struct pinfo_sample *s)
 {
-  char resp_line[MAX_LINE]; // local (kernel) space for a response (before cat into buf)
-  pid_t cur_pid = 0;
-  pid_t par_pid = 0;
-  char comm[sizeof(tsk->comm)+1];
+  const struct pinfo_record *rec = &s->rec;
 
-  cur_pid = task_pid_nr(tsk); //Use kernel functions for access to pid for a process 
-  if (cur_pid == 1) return -1;
-  sprintf(resp_line, "Current PID %d\n", cur_pid); // start forming a response in the buffer
-  printk(KERN_DEBUG "getpinfo: starting  response for pid %d\n", cur_pid);  // goes into /var/log/kern.log
-  strcat(buf, resp_line);
-  
-  get_task_comm(comm, tsk);  // use kernel function for access to command name
-  sprintf(resp_line, "  command %s\n", comm);
-  strcat(buf, resp_line);
-  
-  par_pid = task_pid_nr(tsk->real_parent);
-  sprintf(resp_line, "  parent PID %d\n", par_pid);
-  strcat(respbuf, resp_line);
-  
-  sprintf(resp_line, "  state %ld\n", tsk->state);
-  strcat(respbuf, resp_line);
-  
-  sprintf(resp_line, "  flags 0x%08x\n", tsk->flags);
-  strcat(respbuf, resp_line);
-  
-  sprintf(resp_line, "  priority %d\n", tsk->normal_prio);
-  strcat(respbuf, resp_line);
-
-  printk(KERN_DEBUG "getpinfo: entering critical section for pid %d\n", cur_pid);  // goes into /var/log/kern.log
-  // Virtual Memory critical section
-  down_read(&(tsk->mm->mmap_sem));
-  sprintf(resp_line, "  VM areas %d\n", tsk->mm->map_count);
-  strcat(respbuf, resp_line);
-  
-  sprintf(resp_line, "  VM shared %ld\n", tsk->mm->shared_vm);
-  strcat(respbuf, resp_line);
+  pinfo_printf(pb, "Current PID %d\n", rec->pid); // start forming a response at the cursor
+  pinfo_printf(pb, "  command %s\n", s->comm);
+  pinfo_printf(pb, "  parent PID %d\n", rec->ppid);
+  pinfo_printf(pb, "  state %lld\n", rec->state);
+  pinfo_printf(pb, "  flags 0x%08x\n", rec->flags);
+  pinfo_printf(pb, "  priority %d\n", rec->normal_prio);
+  pinfo_printf(pb, "  VM areas %d\n", rec->map_count);
+  pinfo_printf(pb, "  VM shared %llu\n", rec->shared_vm);
+  pinfo_printf(pb, "  VM exec %llu\n", rec->exec_vm);
+  pinfo_printf(pb, "  VM stack %llu\n", rec->stack_vm);
+  pinfo_printf(pb, "  VM total %llu\n", rec->total_vm);
+  if (rec->vm_sample != PINFO_VM_NONE)
+    pinfo_printf(pb, "  VM sample %s at %llu ns\n",
+                 rec->vm_sample == PINFO_VM_LOCKED ? "locked" : "lockless", rec->sample_ns);
+  pinfo_printf(pb, "  threads %u\n", rec->nr_threads);
+  pinfo_printf(pb, "  CPU time %llu ns\n", rec->runtime_ns);
+  pinfo_printf(pb, "  context switches %llu voluntary, %llu involuntary\n", rec->nvcsw, rec->nivcsw);
+  if (q->sched) {
+    pinfo_printf(pb, "  last CPU %d\n", s->sched.cpu);
+    pinfo_printf(pb, "  policy %u, priority %d, static %d, real-time %u\n", s->sched.policy,
+                 s->sched.prio, s->sched.static_prio, s->sched.rt_priority);
+    pinfo_printf(pb, "  run queue wait %llu ns over %llu runs\n", s->sched.run_delay_ns, s->sched.pcount);
+  }
+  if (q->mem) {
+    pinfo_printf(pb, "  RSS anon %llu, file %llu, shmem %llu\n", s->mem.rss_anon,
+                 s->mem.rss_file, s->mem.rss_shmem);
+    pinfo_printf(pb, "  VM locked %llu, pinned %llu\n", s->mem.locked_vm, s->mem.pinned_vm);
+    pinfo_printf(pb, "  page faults %llu minor, %llu major\n", s->mem.min_flt, s->mem.maj_flt);
+  }
+  if (q->io) {
+    pinfo_printf(pb, "  I/O read %llu bytes in %llu calls, %llu from storage\n",
+                 s->io.rchar, s->io.syscr, s->io.read_bytes);
+    pinfo_printf(pb, "  I/O written %llu bytes in %llu calls, %llu to storage, %llu cancelled\n",
+                 s->io.wchar, s->io.syscw, s->io.write_bytes, s->io.cancelled_write_bytes);
+    if (s->io.interval_ns != 0)
+      pinfo_printf(pb, "  I/O rate read %llu, written %llu, storage %llu/%llu bytes/s over %llu ns\n",
+                   s->io.rchar_rate, s->io.wchar_rate, s->io.read_rate, s->io.write_rate,
+                   s->io.interval_ns);
+  }
+  return 0;
+}
+
+/* This function adds a record to a buffer in the form the call asked
+ * for.  A binary record goes in whole, with the parts the call asked
+ * for, or not at all.
+ */
+static int put_record(const struct pinfo_query *q, struct pinfo_buf *pb,
+                      const struct pinfo_sample *s)
+{
+  size_t len = pb->len;
 
-  sprintf(resp_line, "  VM exec %ld\n", tsk->mm->exec_vm);
-  strcat(respbuf, resp_line);
+  if (!q->binary)
+    return gen_pinfo_string(pb, q, s);
+  if (pinfo_append(pb, &s->rec, sizeof(s->rec)) == 0 &&
+      (!q->sched || pinfo_append(pb, &s->sched, sizeof(s->sched)) == 0) &&
+      (!q->mem || pinfo_append(pb, &s->mem, sizeof(s->mem)) == 0) &&
+      (!q->io || pinfo_append(pb, &s->io, sizeof(s->io)) == 0))
+    return 0;
+  pb->len = len;
+  return -ENOSPC;
+}
 
-  sprintf(resp_line, "  VM stack %ld\n", tsk->mm->stack_vm);
-  strcat(respbuf, resp_line);
+/* This function adds a record to the response, counting it in the
+ * header of a binary one.
+ */
+static int emit_pinfo(struct pinfo_ctx *ctx, const struct pinfo_sample *s)
+{
+  int rc = put_record(&ctx->query, ctx->out, s);
 
-  sprintf(resp_line, "  VM total %ld\n", tsk->mm->total_vm);
-  strcat(respbuf, resp_line);
-  
-  up_read(&(tsk->mm->mmap_sem));
-  // End Virtual memory critical section
-  printk(KERN_DEBUG "getpinfo: exited critical section for pid %d\n", cur_pid);  // goes into /var/log/kern.log
-  
+  if (ctx->query.binary && rc == 0)
+    ((struct pinfo_header *)ctx->out->buf)->count++;
+  else if (ctx->query.binary)
+    ((struct pinfo_header *)ctx->out->buf)->flags |= PINFO_TRUNCATED;
+  return rc;
+}
+
+/* This function adds the info for entries first to end - 1 of the task
+ * set to a buffer: a record for each task, and in text the rank of a
+ * task in a "top" call and a line for a listed pid with no task.  It
+ * returns the number of binary records added, and sets *truncated if
+ * any did not fit.
+ */
+static u32 gen_range(struct pinfo_ctx *ctx, struct pinfo_buf *pb, unsigned int first,
+                     unsigned int end, bool *truncated)
+{
+  const struct pinfo_query *q = &ctx->query;
+  struct pinfo_sample s;
+  struct task_struct *tsk;
+  unsigned int i;
+  u32 count = 0;
+
+  for (i = first; i < end; i++) {
+    tsk = ctx->set.tasks[i];
+    if (q->top && !q->binary)
+      pinfo_printf(pb, "Top %u: %s %llu\n", i + 1, field_names[q->field], ctx->top[i].value);
+    if (tsk == NULL) {
+      if (!q->binary)  // a listed pid with no task
+        pinfo_printf(pb, "PID %d: no such process\n", ctx->pids[i]);
+    }
+    else if (sample_task(q, tsk, &s) == 0) {
+      if (put_record(q, pb, &s) == 0)
+        count++;
+      else
+        *truncated = true;
+    }
+    cond_resched();
+  }
+  return count;
+}
+
+/* A "parallel" call splits the task set into parts of at least
+ * PINFO_PART_MIN tasks, at most one per online CPU, each sampled by a
+ * worker on its CPU into a buffer of its own.  The parts and their
+ * buffers are kept in the context and reused by the calls that follow;
+ * a buffer starts at PINFO_PART_BUF bytes and keeps what it grew to.
+ */
+#define PINFO_PART_MIN 256
+#define PINFO_PART_BUF PAGE_SIZE
+
+struct pinfo_part {
+  struct work_struct work;
+  struct pinfo_ctx *ctx;
+  unsigned int first, end;  // the set entries of the part
+  struct pinfo_buf buf;
+  u32 count;                // binary records in buf
+  bool truncated;
+};
+
+static void part_work(struct work_struct *work)
+{
+  struct pinfo_part *part = container_of(work, struct pinfo_part, work);
+
+  part->count = gen_range(part->ctx, &part->buf, part->first, part->end, &part->truncated);
+}
+
+/* This function generates the info for the task set with a worker per
+ * CPU, then adds the parts' buffers to the response in order, so it is
+ * the same as gen_range() would make.  The workers only read the
+ * context, which the caller keeps locked.  CPU hotplug is held off
+ * while the workers run, like schedule_on_each_cpu() does.  A set too
+ * small to split, or no memory for the parts, is done in place.
+ */
+static u32 gen_parallel(struct pinfo_ctx *ctx, bool *truncated)
+{
+  struct pinfo_buf *out = ctx->out;
+  struct pinfo_part *parts;
+  struct pinfo_part *p;
+  unsigned int nr = ctx->set.nr, nr_parts, per, i;
+  size_t rec_size, fit;
+  u32 count = 0;
+  int cpu;
+
+  get_online_cpus();
+  nr_parts = min(num_online_cpus(), DIV_ROUND_UP(nr, PINFO_PART_MIN));
+  if (nr_parts > 1 && ctx->parts == NULL)
+    ctx->parts = kcalloc(nr_cpu_ids, sizeof(*ctx->parts), GFP_KERNEL);
+  parts = ctx->parts;
+  for (i = 0; parts != NULL && i < nr_parts; i++) {
+    p = &parts[i];
+    if (p->buf.buf == NULL) {
+      p->buf.buf = kvmalloc(PINFO_PART_BUF, GFP_KERNEL);
+      if (p->buf.buf == NULL)
+        break;
+      p->buf.size = PINFO_PART_BUF;
+    }
+    pinfo_reset(&p->buf);
+  }
+  if (nr_parts <= 1 || parts == NULL || i < nr_parts) {
+    put_online_cpus();
+    return gen_range(ctx, out, 0, nr, truncated);
+  }
+  per = DIV_ROUND_UP(nr, nr_parts);
+  i = 0;
+  for_each_online_cpu(cpu) {
+    if (i == nr_parts)
+      break;
+    p = &parts[i];
+    p->ctx = ctx;
+    p->truncated = false;
+    p->first = min(i * per, nr);
+    p->end = min(p->first + per, nr);
+    INIT_WORK(&p->work, part_work);
+    queue_work_on(cpu, getpinfo_pwq, &p->work);
+    i++;
+  }
+  for (i = 0; i < nr_parts; i++)
+    flush_work(&parts[i].work);
+  put_online_cpus();
+
+  rec_size = ctx->query.binary ? ((struct pinfo_header *)out->buf)->rec_size : 0;
+  for (i = 0; i < nr_parts; i++) {
+    p = &parts[i];
+    if (p->truncated)
+      *truncated = true;
+    if (!ctx->query.binary) {
+      if (pinfo_append(out, p->buf.buf, p->buf.len + 1) == 0)
+        out->len--;  // the '\0' keeps text a string
+      else {  // a ring slot is full, take the text that fits
+        fit = out->size - out->len - 1;
+        pinfo_append(out, p->buf.buf, fit);
+        out->buf[out->len] = '\0';
+        *truncated = true;
+      }
+    }
+    else if (p->buf.len == 0 || pinfo_append(out, p->buf.buf, p->buf.len) == 0)
+      count += p->count;
+    else {  // a ring slot is full, take the records that fit
+      fit = min_t(size_t, (out->size - out->len) / rec_size, p->count);
+      pinfo_append(out, p->buf.buf, fit * rec_size);
+      count += fit;
+      *truncated = true;
+    }
+  }
+  return count;
+}
+
+static void parts_free(struct pinfo_ctx *ctx)
+{
+  unsigned int i;
+
+  if (ctx->parts == NULL)
+    return;
+  for (i = 0; i < nr_cpu_ids; i++)
+    kvfree(ctx->parts[i].buf.buf);
+  kfree(ctx->parts);
+}
+
+static int cmp_sample_pid(const void *a, const void *b)
+{
+  const struct pinfo_sample *sa = a, *sb = b;
+
+  return (sa->rec.pid > sb->rec.pid) - (sa->rec.pid < sb->rec.pid);
+}
+
+/* Tells whether a task's reported info differs between two samples;
+ * how and when the VM fields were read does not count, nor do the CPU
+ * and fault counters, which change whenever a task runs, or where it
+ * last ran.  The I/O counters do, as a call asks for them to find the
+ * tasks doing I/O.
+ */
+static bool sample_changed(const struct pinfo_sample *a, const struct pinfo_sample *b)
+{
+  return a->rec.ppid != b->rec.ppid || a->rec.state != b->rec.state ||
+         a->rec.flags != b->rec.flags || a->rec.normal_prio != b->rec.normal_prio ||
+         a->rec.map_count != b->rec.map_count || a->rec.shared_vm != b->rec.shared_vm ||
+         a->rec.exec_vm != b->rec.exec_vm || a->rec.stack_vm != b->rec.stack_vm ||
+         a->rec.total_vm != b->rec.total_vm || a->rec.nr_threads != b->rec.nr_threads ||
+         a->sched.policy != b->sched.policy || a->sched.prio != b->sched.prio ||
+         a->sched.static_prio != b->sched.static_prio ||
+         a->sched.rt_priority != b->sched.rt_priority ||
+         a->mem.rss_anon != b->mem.rss_anon || a->mem.rss_file != b->mem.rss_file ||
+         a->mem.rss_shmem != b->mem.rss_shmem || a->mem.locked_vm != b->mem.locked_vm ||
+         a->mem.pinned_vm != b->mem.pinned_vm || a->io.rchar != b->io.rchar ||
+         a->io.wchar != b->io.wchar || a->io.syscr != b->io.syscr || a->io.syscw != b->io.syscw ||
+         a->io.read_bytes != b->io.read_bytes || a->io.write_bytes != b->io.write_bytes ||
+         a->io.cancelled_write_bytes != b->io.cancelled_write_bytes ||
+         strcmp(a->comm, b->comm) != 0;
+}
+
+/* This function generates the response to a delta call.
+ *
+ * Every task in the set is sampled into a snapshot sorted by pid,
+ * which is merged with the previous call's snapshot: only tasks that
+ * are new or changed are formatted, then the pids of tasks that are
+ * gone are added.  If the generation given is not that of the
+ * previous snapshot, every task counts as new.  The snapshot then
+ * becomes the previous one for the next call.
+ */
+static int gen_delta(struct pinfo_ctx *ctx)
+{
+  struct pinfo_snap *old = &ctx->snap[0], *new = &ctx->snap[1];
+  struct pinfo_snap tmp;
+  struct pinfo_sample *samples;
+  unsigned int i, j, nr_old;
+  bool delta = ctx->query.since != 0 && ctx->query.since == ctx->gen;
+  u64 gen = atomic64_inc_return(&pinfo_generation);
+  s32 pid;
+
+  if (new->size < ctx->set.nr) {
+    samples = kvmalloc_array(ctx->set.nr, sizeof(*samples), GFP_KERNEL);
+    if (samples == NULL)
+      return -ENOMEM;
+    kvfree(new->samples);
+    new->samples = samples;
+    new->size = ctx->set.nr;
+  }
+  new->nr = 0;
+  for (i = 0; i < ctx->set.nr; i++) {
+    struct pinfo_sample *s = &new->samples[new->nr];
+
+    if (ctx->set.tasks[i] != NULL && sample_task(&ctx->query, ctx->set.tasks[i], s) == 0)
+      new->nr++;
+    cond_resched();
+  }
+  sort(new->samples, new->nr, sizeof(*new->samples), cmp_sample_pid, NULL);
+  for (i = j = 0; i < new->nr; i++)  // a pid may have been listed twice
+    if (j == 0 || new->samples[i].rec.pid != new->samples[j - 1].rec.pid)
+      new->samples[j++] = new->samples[i];
+  new->nr = j;
+
+  if (ctx->query.binary) {
+    struct pinfo_header *hdr = (struct pinfo_header *)ctx->out->buf;
+
+    hdr->generation = gen;
+    if (delta)
+      hdr->flags |= PINFO_DELTA;
+  }
+  else if (delta)
+    pinfo_printf(ctx->out, "Generation %llu since %llu\n", gen, ctx->query.since);
+  else
+    pinfo_printf(ctx->out, "Generation %llu\n", gen);
+
+  // new and changed tasks, then the tasks that are gone
+  nr_old = delta ? old->nr : 0;
+  for (i = j = 0; j < new->nr; j++) {
+    while (i < nr_old && old->samples[i].rec.pid < new->samples[j].rec.pid)
+      i++;
+    if (i < nr_old && old->samples[i].rec.pid == new->samples[j].rec.pid) {
+      if (ctx->query.io)
+        io_rates(&new->samples[j].io, &old->samples[i].io,
+                 old->samples[i].io_ns, new->samples[j].io_ns);
+      if (!sample_changed(&old->samples[i], &new->samples[j]))
+        continue;
+    }
+    emit_pinfo(ctx, &new->samples[j]);
+  }
+  for (i = j = 0; i < nr_old; i++) {
+    pid = old->samples[i].rec.pid;
+    while (j < new->nr && new->samples[j].rec.pid < pid)
+      j++;
+    if (j < new->nr && new->samples[j].rec.pid == pid)
+      continue;
+    if (!ctx->query.binary)
+      pinfo_printf(ctx->out, "Exited PID %d\n", pid);
+    else if (pinfo_append(ctx->out, &pid, sizeof(pid)) == 0)
+      ((struct pinfo_header *)ctx->out->buf)->nr_exited++;
+    else
+      ((struct pinfo_header *)ctx->out->buf)->flags |= PINFO_TRUNCATED;
+  }
+
+  tmp = *old;
+  *old = *new;
+  *new = tmp;
+  ctx->gen = gen;
   return 0;
 }
 
+/* This function is executed when a user program does a poll(),
+ * select() or epoll_wait() on the debugfs file.  The file is
+ * readable (EPOLLIN) unless a call made with O_NONBLOCK is still
+ * running, as read() then does not wait, and has exceptional data
+ * (EPOLLPRI) while any of its watches has fired.
+ */
+
+static __poll_t getpinfo_poll(struct file *file, poll_table *wait)
+{
+  struct pinfo_ctx *ctx = file->private_data;
+  struct pinfo_watcher *wr = READ_ONCE(ctx->watcher);
+  __poll_t mask = 0;
+
+  poll_wait(file, &ctx->wait, wait);
+  if (!READ_ONCE(ctx->busy))
+    mask |= EPOLLIN | EPOLLRDNORM;
+  if (wr != NULL && READ_ONCE(wr->nr_fired) != 0)
+    mask |= EPOLLPRI;
+  return mask;
+}
+
+/* This function is executed when a user program does an mmap() of
+ * the debugfs file.  It maps the context's snapshot ring read-only.
+ */
+
+static int getpinfo_mmap(struct file *file, struct vm_area_struct *vma)
+{
+  struct pinfo_ctx *ctx = file->private_data;
+  int rc;
+
+  if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PINFO_RING_SIZE)
+    return -EINVAL;
+  if (vma->vm_flags & VM_WRITE)
+    return -EPERM;
+  vma->vm_flags &= ~VM_MAYWRITE;
+
+  mutex_lock(&ctx->lock);
+  rc = ring_alloc(ctx);
+  if (rc == 0)
+    rc = remap_vmalloc_range(vma, ctx->ring, 0);
+  mutex_unlock(&ctx->lock);
+  return rc;
+}
+
 /* This function emulates the return from a system call by returning
  * the response to the user as a character string.  It is executed 
  * when the user program does a read() to the debugfs file used for 
@@ -182,54 +2871,100 @@ static int gen_pinfo_string(char *buf, struct task_struct *tsk)
  * buffer, and count is a maximum size of the buffer space. 
  * 
  * The user space program is blocked at the read() call until this 
- * function returns.
+ * function returns, and until a call made with O_NONBLOCK has been
+ * run, unless the file was opened with O_NONBLOCK (-EAGAIN).
+ *
+ * A response larger than the user's buffer is returned by successive
+ * read() calls, each continuing at the file offset where the last
+ * one stopped.  The call is complete once all of it has been read.
+ * A streamed response (a VMA listing) is generated a part at a time
+ * as the reads reach the end of the part in the buffer, whose first
+ * byte is at offset win_start; it can only be read in order.
+ *
+ * The read is done through an iov_iter so the file also supports
+ * readv(), splice() and sendfile().
  */
 
-static ssize_t getpinfo_return(struct file *file, char __user *userbuf,
-                                size_t count, loff_t *ppos)
+static ssize_t getpinfo_return(struct kiocb *iocb, struct iov_iter *to)
 {
-  int rc; 
+  ssize_t rc; 
+  loff_t end;
+  struct file *file = iocb->ki_filp;
+  loff_t *ppos = &iocb->ki_pos;
+  size_t count = iov_iter_count(to);
+  struct pinfo_ctx *ctx = file->private_data;
+  struct pinfo_buf *resp = &ctx->resp;
+
+  if (READ_ONCE(ctx->busy)) { // the call is still running in a worker
+     if (file->f_flags & O_NONBLOCK)
+        return -EAGAIN;
+     if (wait_event_interruptible(ctx->wait, !READ_ONCE(ctx->busy)))
+        return -ERESTARTSYS;
+  }
 
-  preempt_disable(); // protect static variables
+  mutex_lock(&ctx->lock); // protect the call context
 
-  if (current != call_task) { // return response only to the process making
-                              // the getpinfo request
-     preempt_enable();
+  if (current != ctx->call_task) { // return response only to the process making
+                                   // the getpinfo request
+     mutex_unlock(&ctx->lock);
      return 0;  // a return of zero on a read indicates no data returned
   }
+  if (ctx->async_rc != 0) { // the call failed in the worker
+     rc = ctx->async_rc;
+     ctx->async_rc = 0;
+     call_end(ctx);
+     mutex_unlock(&ctx->lock);
+     return rc;
+  }
 
-  rc = strlen(respbuf) + 1; /* length includes string termination */
-
-  /* return at most the user specified length with a string 
-   * termination as the last byte.  Use the kernel function to copy
-   * from kernel space to user space.
-   */
+  if (ctx->more && *ppos == ctx->win_start + resp->len) { // generate the next part
+    ctx->win_start += resp->len;
+    pinfo_reset(resp);
+    rc = vma_fill(ctx);
+    if (rc != 0) {
+      mutex_unlock(&ctx->lock);
+      return rc;
+    }
+  }
 
-  /* Use the kernel function to copy from kernel space to user space.
-   */
-  if (count < rc) { // user's buffer is smaller than response string
-    respbuf[count - 1] = '\0'; // truncate response string
-    rc = copy_to_user(userbuf, respbuf, count); // count is returned in rc
+  end = ctx->win_start + resp->len;
+  if (!ctx->query.binary && !ctx->more)
+    end += 1; /* length includes string termination */
+  if (*ppos < ctx->win_start || *ppos > end) {
+    mutex_unlock(&ctx->lock);
+    return -EINVAL;
   }
-  else 
-    rc = copy_to_user(userbuf, respbuf, rc); // rc is unchanged
 
-  kfree(respbuf); // free allocated kernel space
+  /* return at most the user specified length of what is left.
+   * Use the kernel function to copy from kernel space to user space.
+   */
+  rc = min_t(loff_t, count, end - *ppos);
+  rc = copy_to_iter(resp->buf + (*ppos - ctx->win_start), rc, to);
+  if (rc == 0 && count != 0 && end != *ppos)
+    rc = -EFAULT;
+  else
+    *ppos += rc;  /* advance the offset past the bytes returned */
 
-  respbuf = NULL;
-  call_task = NULL; // response returned so another request can be done
+  if (*ppos == end && !ctx->more)
+    call_end(ctx);  // response returned so another request can be done
 
-  preempt_enable(); // clear the disable flag
+  mutex_unlock(&ctx->lock);
 
-  *ppos = 0;  /* reset the offset to zero */
   return rc;  /* read() calls return the number of bytes */
 } 
 
 // Defines the functions in this module that are executed
-// for user read() and write() calls to the debugfs file
+// for user open(), close(), read(), write() and mmap() calls to the debugfs file;
+// splice() and sendfile() read through read_iter
 static const struct file_operations my_fops = {
-        .read = getpinfo_return,
+        .owner = THIS_MODULE,
+        .open = getpinfo_open,
+        .release = getpinfo_release,
+        .read_iter = getpinfo_return,
+        .splice_read = generic_file_splice_read,
         .write = getpinfo_call,
+        .mmap = getpinfo_mmap,
+        .poll = getpinfo_poll,
 };
 
 /* This function is called when the module is loaded into the kernel
@@ -240,22 +2975,38 @@ static const struct file_operations my_fops = {
 
 static int __init getpinfo_module_init(void)
 {
+  getpinfo_wq = alloc_workqueue("getpinfo", WQ_UNBOUND, 0);
+  if (getpinfo_wq == NULL)
+     return -ENOMEM;
+  getpinfo_pwq = alloc_workqueue("getpinfo_parallel", WQ_CPU_INTENSIVE, 0);
+  if (getpinfo_pwq == NULL) {
+     destroy_workqueue(getpinfo_wq);
+     return -ENOMEM;
+  }
 
   /* create an in-memory directory to hold the file */
 
   dir = debugfs_create_dir(dir_name, NULL);
   if (dir == NULL) {
     printk(KERN_DEBUG "getpinfo: error creating %s directory\n", dir_name);
+     destroy_workqueue(getpinfo_pwq);
+     destroy_workqueue(getpinfo_wq);
      return -ENODEV;
   }
 
   /* create the in-memory file used for communication;
-   * make the permission read+write by "world"
+   * make the permission read+write by "world".  The "unsafe" variant
+   * uses my_fops as is; the regular one interposes proxy operations
+   * that do not pass mmap() through.  The module cannot be removed
+   * while the file is open, which is the protection it gives up.
    */
 
-  file = debugfs_create_file(file_name, 0666, dir, &file_value, &my_fops);
+  file = debugfs_create_file_unsafe(file_name, 0666, dir, &file_value, &my_fops);
   if (file == NULL) {
     printk(KERN_DEBUG "getpinfo: error creating %s file\n", file_name);
+     debugfs_remove(dir);
+     destroy_workqueue(getpinfo_pwq);
+     destroy_workqueue(getpinfo_wq);
      return -ENODEV;
   }
 
@@ -265,16 +3016,21 @@ static int __init getpinfo_module_init(void)
 }
 
 /* This function is called when the module is removed from the kernel
- * with rmmod.  It cleans up by deleting the directory and file and
- * freeing any memory still allocated.
+ * with rmmod.  It cleans up by deleting the directory and file
+ * (contexts are freed when their files are closed, which must
+ * happen before the module can be removed).
  */
 
 static void __exit getpinfo_module_exit(void)
 {
+  struct pinfo_result *r, *tmp;
+
   debugfs_remove(file);
   debugfs_remove(dir);
-  if (respbuf != NULL)
-     kfree(respbuf);
+  destroy_workqueue(getpinfo_pwq);
+  destroy_workqueue(getpinfo_wq);
+  list_for_each_entry_safe(r, tmp, &pinfo_results, node)
+    result_unlink(r);
 }
 
 /* Declarations required in building a module */
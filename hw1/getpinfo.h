@@ -1,10 +1,285 @@
+#include <linux/types.h> /* fixed size types usable in the module and user programs */
+
 #define MAX_CALL 100 // characters in call request string
 #define MAX_LINE 100 // characters in a single pid response string
 #define MAX_ENTRY 200 // total characters in buffer
 #define MAX_SIBLINGS 5  // total number of entrys to return (including caller)
+#define MAX_PIDS 4096 // pids in a "getpinfo pids" call
+#define MAX_PIDS_CALL (MAX_CALL + 8 * MAX_PIDS) // characters in a call string with pids
+#define MAX_SAMPLED 64 // tasks the sampler of an open file can watch
+#define MAX_WATCHES 64 // threshold watches on an open file
+#define MAX_WSS 16 // address spaces in a working-set call
+#define MAX_TOP 1024 // processes in a "getpinfo top" call
+#define MAX_PREDS 16 // conditions in a "where" clause
 // define the debugfs path name directory and file
 // full path name will be /sys/kernel/debug/getpid/call
 char dir_name[] = "getpid";
 char file_name[] = "call";
 
 
+
+/* A "getpinfo binary" call returns binary records in place of the
+ * text response: a struct pinfo_header followed by count records of
+ * rec_size bytes each, then nr_exited pids (__s32).  A record starts
+ * with the fields of struct pinfo_record; later versions only add
+ * fields at the end, so a program should step through records by
+ * rec_size.  (The header grew to its current size in version 3.)
+ */
+#define PINFO_MAGIC 0x464e4950  /* "PINF" */
+#define PINFO_VERSION 5
+
+struct pinfo_header {
+  __u32 magic;
+  __u16 version;
+  __u16 rec_size;   // bytes in each record
+  __u32 count;      // records following the header
+  __u32 flags;      // PINFO_TRUNCATED if records did not fit
+  __u64 generation; // token for the next "since" call, 0 if not asked for
+  __u32 nr_exited;  // pids following the records
+  __u32 reserved;
+};
+
+#define PINFO_TRUNCATED 0x1
+#define PINFO_DELTA 0x2      // only changes since the generation given
+#define PINFO_TICKS 0x4      // the records are struct pinfo_tick
+#define PINFO_EVENTS 0x8     // the records are struct pinfo_event
+#define PINFO_SCHED 0x10     // each record is followed by a struct pinfo_sched
+#define PINFO_MEM 0x20       // ... then by a struct pinfo_mem
+#define PINFO_IO 0x40        // ... then by a struct pinfo_io
+
+/* A call with "since <generation>" returns only the records that
+ * changed since the response carrying that generation, and the pids
+ * of tasks reported then that are gone now.  The first call uses
+ * "since 0"; if the generation is not the last one returned on the
+ * open file, the response is a full one, without PINFO_DELTA.
+ */
+
+struct pinfo_record {
+  __s32 pid;
+  __s32 ppid;         // (real_parent)
+  __s64 state;
+  __u32 flags;
+  __s32 normal_prio;
+  __s32 map_count;    // VM areas
+  __u32 vm_sample;    // how the VM fields were read, PINFO_VM_*
+  __u64 shared_vm;    // pages
+  __u64 exec_vm;
+  __u64 stack_vm;
+  __u64 total_vm;
+  __u64 sample_ns;    // CLOCK_MONOTONIC time the VM fields were read (version 2)
+  __u32 nr_threads;   // tasks the record covers (version 4)
+  __u32 reserved;
+  __u64 runtime_ns;   // CPU time (se.sum_exec_runtime)
+  __u64 nvcsw;        // voluntary context switches
+  __u64 nivcsw;       // involuntary context switches
+};
+
+/* With "groups", a call reports each thread group (process) once, in
+ * a record for its leader: the VM fields of the shared mm, and the CPU
+ * time and context switches of all its threads, including those that
+ * have exited.  nr_threads counts the threads alive.  Otherwise each
+ * record covers one task and nr_threads is 1.
+ */
+
+/* With "sched", each record is followed by the task's scheduler
+ * details (PINFO_SCHED), counted in rec_size.  For a thread group the
+ * run queue fields add up its live threads.  run_delay_ns and pcount
+ * are 0 on kernels built without CONFIG_SCHED_INFO.
+ */
+struct pinfo_sched {
+  __s32 cpu;          // CPU the task last ran on
+  __u32 policy;       // SCHED_*
+  __s32 prio;         // effective priority, may be boosted above normal_prio
+  __s32 static_prio;  // from the nice value
+  __u32 rt_priority;  // for SCHED_FIFO and SCHED_RR
+  __u32 reserved;
+  __u64 run_delay_ns; // time spent runnable, waiting on a run queue
+  __u64 pcount;       // times run on a CPU
+};
+
+/* With "mem", each record is followed (after any struct pinfo_sched)
+ * by the resident and locked pages of the task's mm, which the VM
+ * fields, counting mapped pages, do not tell (PINFO_MEM).  The page
+ * faults are the task's own, or those of all the threads of a group,
+ * including the threads that have exited.
+ */
+struct pinfo_mem {
+  __u64 rss_anon;     // resident pages, by kind
+  __u64 rss_file;
+  __u64 rss_shmem;
+  __u64 locked_vm;    // pages mlock()ed
+  __u64 pinned_vm;    // pages pinned by drivers
+  __u64 min_flt;      // page faults not needing I/O
+  __u64 maj_flt;      // page faults needing I/O
+};
+
+/* With "io", each record is followed (after any struct pinfo_sched
+ * and struct pinfo_mem) by the task's I/O accounting (PINFO_IO), for
+ * a thread group that of all its threads.  In a delta call a task
+ * whose I/O counters moved counts as changed, and the rates are over
+ * the time since it was sampled for the generation given; otherwise
+ * there are no rates.  The sampler's samples carry the I/O fields too,
+ * with rates since the task's previous sample.  The syscall counts
+ * need CONFIG_TASK_XACCT and the storage counts
+ * CONFIG_TASK_IO_ACCOUNTING, and are 0 without them.
+ */
+struct pinfo_io {
+  __u64 rchar;        // bytes read and written by syscalls
+  __u64 wchar;
+  __u64 syscr;        // read and write syscalls
+  __u64 syscw;
+  __u64 read_bytes;   // bytes read from and written to storage
+  __u64 write_bytes;
+  __u64 cancelled_write_bytes;  // written, then truncated before reaching storage
+  __u64 interval_ns;  // time the rates are over, 0 for no rates
+  __u64 rchar_rate;   // bytes per second
+  __u64 wchar_rate;
+  __u64 read_rate;
+  __u64 write_rate;
+};
+
+/* The VM fields are read without waiting for the mm's lock.  If the
+ * lock was free they are a consistent snapshot (PINFO_VM_LOCKED);
+ * otherwise each is read as it is at that moment (PINFO_VM_LOCKLESS)
+ * and they may be off by a change in progress.  A task with no user
+ * memory, like a kernel thread, has no VM fields (PINFO_VM_NONE).
+ */
+#define PINFO_VM_NONE 0
+#define PINFO_VM_LOCKED 1
+#define PINFO_VM_LOCKLESS 2
+
+/* A "getpinfo sample <period_us>" call has the module sample the
+ * tasks of the call's scope (at most MAX_SAMPLED, e.g. "sample 1000
+ * pids 12 34") every period_us microseconds from a timer, until the
+ * file is closed or "sample 0" stops it.  Samples are buffered per
+ * CPU, PINFO_TICKS_PER_CPU at most; once a CPU's buffer is full its
+ * new samples are dropped.  A "getpinfo drain" call returns and
+ * removes the buffered samples as binary records of struct
+ * pinfo_tick, in time order for each CPU, with PINFO_TRUNCATED set if
+ * any were dropped since the last drain.
+ */
+#define PINFO_MIN_PERIOD_US 100
+#define PINFO_TICKS_PER_CPU 4096
+
+struct pinfo_tick {
+  __u64 time_ns;      // CLOCK_MONOTONIC
+  __s32 pid;
+  __u32 cpu;          // the CPU the sample was taken on
+  __s64 state;
+  __s32 map_count;
+  __u32 flags;        // PINFO_TICK_*
+  __u64 total_vm;     // pages
+  __u64 shared_vm;
+  __u64 exec_vm;
+  __u64 stack_vm;
+  __u64 runtime_ns;   // time run on a CPU (se.sum_exec_runtime)
+  __u64 nvcsw;        // voluntary context switches
+  __u64 nivcsw;       // involuntary context switches
+  struct pinfo_io io; // (version 5)
+};
+
+/* The task no longer has the memory it had when sampling started (it
+ * did an exec() or is exiting), so the VM fields are 0; sample it
+ * again to follow the new memory.
+ */
+#define PINFO_TICK_NO_MM 0x1
+
+/* A "getpinfo watch <field> <threshold>" call puts a watch on each
+ * task of the call's scope (e.g. "watch total_vm 100000 pids 12"),
+ * where field is total_vm or map_count.  The module checks the watches
+ * every PINFO_WATCH_PERIOD_MS milliseconds; a watch fires once the
+ * field crosses the threshold from the side it was on when the watch
+ * was put, or when the task can no longer be watched.  poll() and
+ * epoll() on the file report EPOLLPRI while any watch has fired.  A
+ * "getpinfo watches" call then returns the fired watches as binary
+ * records of struct pinfo_event and removes them.
+ */
+#define PINFO_WATCH_PERIOD_MS 10
+
+#define PINFO_FIELD_TOTAL_VM 1
+#define PINFO_FIELD_MAP_COUNT 2
+#define PINFO_FIELD_RSS 3     // resident pages, only for "top"
+
+struct pinfo_event {
+  __s32 pid;
+  __u32 field;        // PINFO_FIELD_*
+  __u32 flags;        // PINFO_WATCH_*
+  __u32 reserved;
+  __u64 threshold;
+  __u64 value;        // the field's value when the watch fired
+  __u64 time_ns;      // CLOCK_MONOTONIC time the watch fired
+};
+
+#define PINFO_WATCH_ABOVE 0x1  // the value went above the threshold, else to or below it
+#define PINFO_WATCH_GONE 0x2   // the task exited or did an exec(), value is 0
+
+/* A "getpinfo top <n> <field>" call returns only the n processes (at
+ * most MAX_TOP) with the largest field, largest first, where field is
+ * total_vm, rss or map_count.  The ranking is over all processes, or
+ * over those of a tree with "tree [<pid>]"; kernel threads are left
+ * out.  The processes are picked in the module during one walk of the
+ * task list, so a call costs n records whatever the number of tasks.
+ */
+
+/* A "where <field> <op> <value> [and | or <field> <op> <value>]..."
+ * clause keeps only the tasks that match, e.g. "where total_vm >
+ * 100000 and state == running" or "tree 1234 where comm prefix ssh".
+ * The fields are pid, ppid, state, prio (normal_prio), total_vm, rss
+ * and map_count, compared with ==, !=, <, <=, > or >=, and comm,
+ * compared with ==, != or prefix.  A state can be given by name:
+ * running, sleeping, disk, stopped or traced.  "and" binds tighter
+ * than "or", and there are at most MAX_PREDS conditions.  Tasks are
+ * matched as the task list is walked, before anything is reported.
+ */
+
+/* With "parallel", the tasks of a call are sampled by workers on all
+ * online CPUs, each taking a part of them, and the parts are put
+ * together in order, so the response is the same as without it.  It
+ * pays off for calls over many thousands of tasks.
+ */
+
+/* A call with "share" waits for an identical call already running,
+ * from any open file, and returns its response instead of doing the
+ * same work.  With "fresh <ms>" a call returns the response of an
+ * identical call made at most ms milliseconds ago (at most
+ * PINFO_FRESH_MAX_MS), if there is one.  Calls are identical if they
+ * ask for the same response, whatever the order of their options and
+ * apart from these options and "parallel", and they are made in the
+ * same pid namespace (and by the same task, if they are about the
+ * caller's relatives).  Neither applies to ring, since, sample, drain,
+ * watch, watches, vmas or wss calls.
+ */
+#define PINFO_FRESH_MAX_MS 1000
+
+/* A "getpinfo ring" call publishes its binary response into a ring
+ * that user programs map with mmap() of the same open file, instead
+ * of returning it through read().  The mapping (offset 0, at most
+ * PINFO_RING_SIZE bytes, read-only) starts with a struct pinfo_ring;
+ * snapshot n (counting from 1) is in slot (n - 1) % PINFO_RING_SLOTS,
+ * which starts with a struct pinfo_slot followed by the response.
+ *
+ * A reader takes n = head, then reads the slot's seq, the response,
+ * and seq again.  The snapshot is intact if seq was 2 * n both times;
+ * an odd seq means the slot is being rewritten.
+ */
+#define PINFO_RING_SLOTS 16
+#define PINFO_SLOT_SIZE (64 * 1024)
+#define PINFO_RING_HDR_SIZE 4096
+#define PINFO_RING_SIZE (PINFO_RING_HDR_SIZE + PINFO_RING_SLOTS * PINFO_SLOT_SIZE)
+
+struct pinfo_ring {
+  __u32 magic;      // PINFO_MAGIC
+  __u32 nr_slots;
+  __u32 slot_size;
+  __u32 reserved;
+  __u64 head;       // last snapshot published, 0 if none
+};
+
+struct pinfo_slot {
+  __u64 seq;        // 2 * n once snapshot n is complete
+  __u32 len;        // bytes of response following
+  __u32 reserved;
+};
+
+#define PINFO_SLOT(ring, n) ((struct pinfo_slot *)((char *)(ring) + \
+          PINFO_RING_HDR_SIZE + ((n) - 1) % PINFO_RING_SLOTS * PINFO_SLOT_SIZE))